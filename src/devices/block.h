@@ -53,6 +53,8 @@ struct block *block_next (struct block *);
 block_sector_t block_size (struct block *);
 void block_read (struct block *, block_sector_t, void *);
 void block_write (struct block *, block_sector_t, const void *);
+void block_read_n (struct block *, block_sector_t, void *, size_t cnt);
+void block_write_n (struct block *, block_sector_t, const void *, size_t cnt);
 const char *block_name (struct block *);
 enum block_type block_type (struct block *);
 
@@ -65,6 +67,13 @@ struct block_operations
   {
     void (*read) (void *aux, block_sector_t, void *buffer);
     void (*write) (void *aux, block_sector_t, const void *buffer);
+
+    /* Optional multi-sector transfers of CNT consecutive sectors.
+       If null, block_read_n() and block_write_n() fall back to
+       one read or write call per sector. */
+    void (*read_n) (void *aux, block_sector_t, void *buffer, size_t cnt);
+    void (*write_n) (void *aux, block_sector_t, const void *buffer,
+                     size_t cnt);
   };
 
 struct block *block_register (const char *name, enum block_type,
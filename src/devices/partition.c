@@ -317,8 +317,29 @@ partition_write (void *p_, block_sector_t sector, const void *buffer)
   block_write (p->block, p->start + sector, buffer);
 }
 
+/* Reads CNT sectors starting at SECTOR from partition P into
+   BUFFER, in a single request to the underlying block device. */
+static void
+partition_read_n (void *p_, block_sector_t sector, void *buffer, size_t cnt)
+{
+  struct partition *p = p_;
+  block_read_n (p->block, p->start + sector, buffer, cnt);
+}
+
+/* Writes CNT sectors starting at SECTOR to partition P from
+   BUFFER, in a single request to the underlying block device. */
+static void
+partition_write_n (void *p_, block_sector_t sector, const void *buffer,
+                   size_t cnt)
+{
+  struct partition *p = p_;
+  block_write_n (p->block, p->start + sector, buffer, cnt);
+}
+
 static struct block_operations partition_operations =
   {
     partition_read,
-    partition_write
+    partition_write,
+    partition_read_n,
+    partition_write_n
   };
@@ -0,0 +1,390 @@
+#include "filesys/cache.h"
+#include <debug.h>
+#include <hash.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "filesys/filesys.h"
+#include "filesys/free-map.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* Buffer cache of file system sectors. All reads and writes of
+   the file system device go through it. Sectors are replaced with
+   the clock algorithm. Writes only dirty the cached copy, the
+   flusher thread writes dirty sectors back every CACHE_FLUSH_TICKS
+   and cache_flush at shutdown writes the rest. A read that follows
+   the previous read of the same inode queues the sector after it
+   for the read-ahead thread. */
+
+/* Timer ticks between two write-backs of the dirty sectors. */
+#define CACHE_FLUSH_TICKS TIMER_FREQ
+
+/* Most sectors queued for read-ahead. */
+#define READAHEAD_MAX 16
+
+/* A cached sector. */
+struct cache_entry
+  {
+    block_sector_t sector;      /* Sector held, if valid. */
+    bool valid;                 /* If in use, entry is in the hash. */
+    bool dirty;                 /* If changed since read or written. */
+    bool accessed;              /* Used since the clock hand passed. */
+    bool readahead;             /* Read ahead and not used yet. */
+    bool evicting;              /* Being written back to be replaced,
+                                   no longer in the hash. */
+    int pin_cnt;                /* Threads holding or waiting for lock,
+                                   a pinned entry is not replaced. */
+    struct lock lock;           /* Serializes access to the data. */
+    struct hash_elem hash_elem; /* Element in the sector hash. */
+    uint8_t data[BLOCK_SECTOR_SIZE];  /* Sector data. */
+  };
+
+/* The entries, the sectors they hold and the clock hand. 
+   Protected by cache_lock. A dirty entry being replaced is written
+   back without cache_lock, marked as evicting, so a sector is never
+   read from disk while its newer copy is on the way out. */
+static struct cache_entry cache[CACHE_SIZE];
+static struct hash cache_map;
+static size_t clock_hand;
+static struct lock cache_lock;
+
+/* Read-ahead queue, a ring of sectors. Protected by cache_lock. */
+static block_sector_t readahead_queue[READAHEAD_MAX];
+static size_t readahead_head;
+static size_t readahead_cnt;
+static struct semaphore readahead_sema;
+
+/* Statistics. */
+static unsigned long long hit_cnt;       /* Accesses to cached sectors. */
+static unsigned long long miss_cnt;      /* Sectors read from disk. */
+static unsigned long long write_cnt;     /* Sectors written to disk. */
+static unsigned long long readahead_hits;/* Read-ahead sectors used. */
+
+static struct cache_entry *cache_get (block_sector_t, bool);
+static void cache_put (struct cache_entry *);
+static struct cache_entry *cache_lookup (block_sector_t);
+static struct cache_entry *cache_evict (void);
+static bool cache_evicting (block_sector_t);
+static void cache_flusher (void *);
+static void cache_reader (void *);
+static unsigned cache_hash (const struct hash_elem *, void *);
+static bool cache_less (const struct hash_elem *, const struct hash_elem *,
+                        void *);
+
+/* Initializes the buffer cache and starts its threads. */
+void
+cache_init (void)
+{
+  size_t i;
+
+  lock_init (&cache_lock);
+  hash_init (&cache_map, cache_hash, cache_less, NULL);
+  for (i = 0; i < CACHE_SIZE; i++)
+    lock_init (&cache[i].lock);
+  sema_init (&readahead_sema, 0);
+
+  thread_create ("cache_flusher", PRI_DEFAULT, cache_flusher, NULL);
+  thread_create ("cache_reader", PRI_DEFAULT, cache_reader, NULL);
+}
+
+/* Reads SIZE bytes at offset OFS of SECTOR into BUFFER. */
+void
+cache_read (block_sector_t sector, void *buffer, off_t ofs, off_t size)
+{
+  struct cache_entry *e;
+
+  ASSERT (ofs >= 0 && size >= 0 && ofs + size <= BLOCK_SECTOR_SIZE);
+
+  e = cache_get (sector, true);
+  memcpy (buffer, e->data + ofs, size);
+  cache_put (e);
+}
+
+/* Writes SIZE bytes from BUFFER at offset OFS of SECTOR. A write
+   of the whole sector doesn't need to read it first. */
+void
+cache_write (block_sector_t sector, const void *buffer, off_t ofs, 
+             off_t size)
+{
+  struct cache_entry *e;
+
+  ASSERT (ofs >= 0 && size >= 0 && ofs + size <= BLOCK_SECTOR_SIZE);
+
+  e = cache_get (sector, size < BLOCK_SECTOR_SIZE);
+  memcpy (e->data + ofs, buffer, size);
+  e->dirty = true;
+  cache_put (e);
+}
+
+/* Queues SECTOR to be read into the cache in the background, 
+   unless it is cached already or the queue is full. */
+void
+cache_readahead (block_sector_t sector)
+{
+  lock_acquire (&cache_lock);
+  if (cache_lookup (sector) != NULL || readahead_cnt >= READAHEAD_MAX)
+    {
+      lock_release (&cache_lock);
+      return;
+    }
+  readahead_queue[(readahead_head + readahead_cnt) % READAHEAD_MAX] = sector;
+  readahead_cnt++;
+  lock_release (&cache_lock);
+  sema_up (&readahead_sema);
+}
+
+/* Writes all dirty sectors back to disk. */
+void
+cache_flush (void)
+{
+  size_t i;
+
+  for (i = 0; i < CACHE_SIZE; i++)
+    {
+      struct cache_entry *e = &cache[i];
+
+      lock_acquire (&cache_lock);
+      if (!e->valid || !e->dirty)
+        {
+          lock_release (&cache_lock);
+          continue;
+        }
+      e->pin_cnt++;
+      lock_release (&cache_lock);
+
+      lock_acquire (&e->lock);
+      if (e->dirty)
+        {
+          block_write (fs_device, e->sector, e->data);
+          e->dirty = false;
+          write_cnt++;
+        }
+      cache_put (e);
+    }
+}
+
+/* Prints buffer cache statistics. */
+void
+cache_print_stats (void)
+{
+  printf ("Cache: %llu hits, %llu misses, %llu read ahead hits, "
+          "%llu writes\n", hit_cnt, miss_cnt, readahead_hits, write_cnt);
+}
+
+/* Returns the entry holding SECTOR with its lock held. A sector 
+   not cached yet replaces another one and is read from disk if
+   READ is true, otherwise the caller overwrites all of it. The 
+   caller must release the entry with cache_put. */
+static struct cache_entry *
+cache_get (block_sector_t sector, bool read)
+{
+  struct cache_entry *e;
+
+  lock_acquire (&cache_lock);
+  for (;;)
+    {
+      e = cache_lookup (sector);
+      if (e != NULL)
+        {
+          hit_cnt++;
+          if (e->readahead)
+            readahead_hits++;
+          e->readahead = false;
+          e->accessed = true;
+          e->pin_cnt++;
+          lock_release (&cache_lock);
+          lock_acquire (&e->lock);
+          return e;
+        }
+
+      /* A dirty copy of the sector on its way out must reach the
+         disk before the sector is read again. */
+      if (!cache_evicting (sector))
+        {
+          e = cache_evict ();
+          if (e != NULL)
+            {
+              /* Writing back the victim drops cache_lock, so the 
+                 sector may have been cached meanwhile. */
+              if (cache_lookup (sector) == NULL 
+                  && !cache_evicting (sector))
+                break;
+              continue;
+            }
+        }
+
+      /* Every entry is in use, or the sector is being written 
+         back, wait for it to be put back. */
+      lock_release (&cache_lock);
+      thread_yield ();
+      lock_acquire (&cache_lock);
+    }
+
+  /* The entry's lock is free as it was not pinned. Taking it before
+     the entry shows up in the hash makes the threads that find the
+     sector meanwhile wait until its data is in place. */
+  e->sector = sector;
+  e->valid = true;
+  e->dirty = false;
+  e->readahead = false;
+  e->accessed = true;
+  e->pin_cnt++;
+  lock_acquire (&e->lock);
+  hash_insert (&cache_map, &e->hash_elem);
+  lock_release (&cache_lock);
+
+  if (read)
+    {
+      block_read (fs_device, sector, e->data);
+      miss_cnt++;
+    }
+  else
+    memset (e->data, 0, BLOCK_SECTOR_SIZE);
+  return e;
+}
+
+/* Releases entry E got from cache_get. */
+static void
+cache_put (struct cache_entry *e)
+{
+  lock_release (&e->lock);
+  lock_acquire (&cache_lock);
+  e->pin_cnt--;
+  lock_release (&cache_lock);
+}
+
+/* Returns the valid entry holding SECTOR, or a null pointer if it
+   is not cached. The caller must hold cache_lock. */
+static struct cache_entry *
+cache_lookup (block_sector_t sector)
+{
+  struct cache_entry key;
+  struct hash_elem *e;
+
+  key.sector = sector;
+  e = hash_find (&cache_map, &key.hash_elem);
+  return e != NULL ? hash_entry (e, struct cache_entry, hash_elem) : NULL;
+}
+
+/* Picks an entry to replace with the clock algorithm, removes it
+   from the hash and writes it back if it is dirty. The write is
+   done without cache_lock, with the entry pinned and marked as
+   evicting. Returns a null pointer if every entry is pinned. The
+   caller must hold cache_lock. */
+static struct cache_entry *
+cache_evict (void)
+{
+  size_t i;
+
+  /* Two rounds: the first may only clear accessed bits. */
+  for (i = 0; i < 2 * CACHE_SIZE; i++)
+    {
+      struct cache_entry *e = &cache[clock_hand];
+      clock_hand = (clock_hand + 1) % CACHE_SIZE;
+
+      if (e->pin_cnt > 0)
+        continue;
+      if (!e->valid)
+        return e;
+      if (e->accessed)
+        {
+          e->accessed = false;
+          continue;
+        }
+
+      hash_delete (&cache_map, &e->hash_elem);
+      e->valid = false;
+      if (e->dirty)
+        {
+          e->evicting = true;
+          e->pin_cnt++;
+          lock_release (&cache_lock);
+
+          block_write (fs_device, e->sector, e->data);
+
+          lock_acquire (&cache_lock);
+          e->dirty = false;
+          e->evicting = false;
+          e->pin_cnt--;
+          write_cnt++;
+        }
+      return e;
+    }
+  return NULL;
+}
+
+/* Returns true if SECTOR is being written back by cache_evict.
+   The caller must hold cache_lock. */
+static bool
+cache_evicting (block_sector_t sector)
+{
+  size_t i;
+
+  for (i = 0; i < CACHE_SIZE; i++)
+    if (cache[i].evicting && cache[i].sector == sector)
+      return true;
+  return false;
+}
+
+/* Flusher thread. Writes the dirty sectors back every 
+   CACHE_FLUSH_TICKS, so a crash loses little data and replacing
+   a sector seldom has to write it first. The free map changes 
+   since the last round are written to the cache first. */
+static void
+cache_flusher (void *aux UNUSED)
+{
+  for (;;)
+    {
+      timer_sleep (CACHE_FLUSH_TICKS);
+      free_map_flush ();
+      cache_flush ();
+    }
+}
+
+/* Read-ahead thread. Reads the queued sectors into the cache, 
+   without their accessed bit, so they go first if not used. */
+static void
+cache_reader (void *aux UNUSED)
+{
+  for (;;)
+    {
+      block_sector_t sector;
+      struct cache_entry *e;
+      bool cached;
+
+      sema_down (&readahead_sema);
+      lock_acquire (&cache_lock);
+      sector = readahead_queue[readahead_head];
+      readahead_head = (readahead_head + 1) % READAHEAD_MAX;
+      readahead_cnt--;
+      cached = cache_lookup (sector) != NULL;
+      lock_release (&cache_lock);
+
+      if (!cached)
+        {
+          e = cache_get (sector, true);
+          lock_acquire (&cache_lock);
+          e->accessed = false;
+          e->readahead = true;
+          lock_release (&cache_lock);
+          cache_put (e);
+        }
+    }
+}
+
+/* Returns a hash value for cache entry E. */
+static unsigned
+cache_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  return hash_int (hash_entry (e, struct cache_entry, hash_elem)->sector);
+}
+
+/* Returns true if cache entry A holds a lower sector than B. */
+static bool
+cache_less (const struct hash_elem *a, const struct hash_elem *b,
+            void *aux UNUSED)
+{
+  return hash_entry (a, struct cache_entry, hash_elem)->sector
+         < hash_entry (b, struct cache_entry, hash_elem)->sector;
+}
@@ -0,0 +1,18 @@
+#ifndef FILESYS_CACHE_H
+#define FILESYS_CACHE_H
+
+#include <stdbool.h>
+#include "devices/block.h"
+#include "filesys/off_t.h"
+
+/* Number of sectors kept in the buffer cache. */
+#define CACHE_SIZE 64
+
+void cache_init (void);
+void cache_read (block_sector_t, void *, off_t ofs, off_t size);
+void cache_write (block_sector_t, const void *, off_t ofs, off_t size);
+void cache_readahead (block_sector_t);
+void cache_flush (void);
+void cache_print_stats (void);
+
+#endif /* filesys/cache.h */
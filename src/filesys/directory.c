@@ -1,16 +1,21 @@
 #include "filesys/directory.h"
+#include <hash.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 #include <list.h>
+#include <round.h>
 #include "filesys/filesys.h"
+#include "filesys/free-map.h"
 #include "filesys/inode.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
 
 /* A directory. */
 struct dir 
   {
     struct inode *inode;                /* Backing store. */
-    off_t pos;                          /* Current position. */
+    off_t pos;                          /* Current entry index. */
   };
 
 /* A single directory entry. */
@@ -21,12 +26,94 @@ struct dir_entry
     bool in_use;                        /* In use or free? */
   };
 
+/* A directory is a hash table of buckets, one per sector. A name
+   is kept in the bucket hash_string() of it selects, or if that
+   bucket is full, in the next bucket with a free entry. A bucket
+   that was passed over because it was full is marked as
+   overflowed, so a lookup only goes on to the next bucket after
+   an overflowed one and usually reads a single sector.
+
+   The table doubles when it gets more than DIR_MAX_LOAD_PCT
+   percent full, which rehashes all the entries. */
+
+/* Entries per bucket. */
+#define BUCKET_ENTRIES ((BLOCK_SECTOR_SIZE - 8) / sizeof (struct dir_entry))
+
+/* Fill level at which the table doubles, in percent. */
+#define DIR_MAX_LOAD_PCT 75
+
+/* A bucket, exactly one sector in size. */
+struct dir_bucket
+  {
+    struct dir_entry entries[BUCKET_ENTRIES];
+    uint32_t entry_cnt;                 /* Entries in the directory, only
+                                           kept in bucket 0. */
+    bool overflow;                      /* Was an entry put in a later
+                                           bucket because this was full? */
+    uint8_t unused[BLOCK_SECTOR_SIZE - BUCKET_ENTRIES
+                   * sizeof (struct dir_entry) - 5];
+  };
+
+/* Cache of recently used directory entries, so looking up a name
+   again reads no sector at all. Maps a directory's sector and a
+   name to the sector of the named inode. */
+#define DCACHE_SIZE 64
+
+struct dcache_entry
+  {
+    struct hash_elem hash_elem;         /* Element in dcache_map. */
+    struct list_elem lru_elem;          /* Element in dcache_lru. */
+    bool valid;                         /* In dcache_map? */
+    block_sector_t dir_sector;          /* Directory sector. */
+    char name[NAME_MAX + 1];            /* Name in the directory. */
+    block_sector_t inode_sector;        /* Sector of the named inode. */
+  };
+
+static struct dcache_entry dcache[DCACHE_SIZE];
+static struct hash dcache_map;          /* Valid entries. */
+static struct list dcache_lru;          /* All entries, most recently
+                                           used first. */
+static struct lock dcache_lock;
+
+static size_t bucket_count (struct inode *);
+static size_t home_bucket (const char *, size_t);
+static off_t entry_ofs (size_t, size_t);
+static bool read_bucket (struct inode *, size_t, struct dir_bucket *);
+static bool insert_entry (struct inode *, size_t, const struct dir_entry *);
+static bool grow (struct dir *);
+static bool dcache_lookup (block_sector_t, const char *, block_sector_t *);
+static void dcache_insert (block_sector_t, const char *, block_sector_t);
+static void dcache_remove (block_sector_t, const char *);
+static void dcache_purge (block_sector_t);
+static unsigned dcache_hash (const struct hash_elem *, void *);
+static bool dcache_less (const struct hash_elem *, const struct hash_elem *,
+                         void *);
+
+/* Initializes the directory entry cache. */
+void
+dir_init (void) 
+{
+  size_t i;
+
+  ASSERT (sizeof (struct dir_bucket) == BLOCK_SECTOR_SIZE);
+
+  hash_init (&dcache_map, dcache_hash, dcache_less, NULL);
+  list_init (&dcache_lru);
+  lock_init (&dcache_lock);
+  for (i = 0; i < DCACHE_SIZE; i++)
+    list_push_back (&dcache_lru, &dcache[i].lru_elem);
+}
+
 /* Creates a directory with space for ENTRY_CNT entries in the
    given SECTOR.  Returns true if successful, false on failure. */
 bool
 dir_create (block_sector_t sector, size_t entry_cnt)
 {
-  return inode_create (sector, entry_cnt * sizeof (struct dir_entry));
+  size_t bucket_cnt = DIV_ROUND_UP (entry_cnt, BUCKET_ENTRIES);
+
+  if (bucket_cnt == 0)
+    bucket_cnt = 1;
+  return inode_create (sector, bucket_cnt * BLOCK_SECTOR_SIZE);
 }
 
 /* Opens and returns the directory for the given INODE, of which
@@ -92,22 +179,29 @@ static bool
 lookup (const struct dir *dir, const char *name,
         struct dir_entry *ep, off_t *ofsp) 
 {
-  struct dir_entry e;
-  size_t ofs;
+  struct dir_bucket b;
+  size_t bucket_cnt, idx, i, j;
   
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e) 
-    if (e.in_use && !strcmp (name, e.name)) 
-      {
-        if (ep != NULL)
-          *ep = e;
-        if (ofsp != NULL)
-          *ofsp = ofs;
-        return true;
-      }
+  bucket_cnt = bucket_count (dir->inode);
+  idx = home_bucket (name, bucket_cnt);
+  for (i = 0; i < bucket_cnt && read_bucket (dir->inode, idx, &b); i++)
+    {
+      for (j = 0; j < BUCKET_ENTRIES; j++)
+        if (b.entries[j].in_use && !strcmp (name, b.entries[j].name)) 
+          {
+            if (ep != NULL)
+              *ep = b.entries[j];
+            if (ofsp != NULL)
+              *ofsp = entry_ofs (idx, j);
+            return true;
+          }
+      if (!b.overflow)
+        break;
+      idx = (idx + 1) % bucket_cnt;
+    }
   return false;
 }
 
@@ -119,13 +213,20 @@ bool
 dir_lookup (const struct dir *dir, const char *name,
             struct inode **inode) 
 {
+  block_sector_t dir_sector;
   struct dir_entry e;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-  if (lookup (dir, name, &e, NULL))
+  dir_sector = inode_get_inumber (dir->inode);
+  if (dcache_lookup (dir_sector, name, &e.inode_sector))
     *inode = inode_open (e.inode_sector);
+  else if (lookup (dir, name, &e, NULL))
+    {
+      dcache_insert (dir_sector, name, e.inode_sector);
+      *inode = inode_open (e.inode_sector);
+    }
   else
     *inode = NULL;
 
@@ -142,7 +243,8 @@ bool
 dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
 {
   struct dir_entry e;
-  off_t ofs;
+  uint32_t entry_cnt;
+  off_t cnt_ofs = offsetof (struct dir_bucket, entry_cnt);
   bool success = false;
 
   ASSERT (dir != NULL);
@@ -156,23 +258,27 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
   if (lookup (dir, name, NULL, NULL))
     goto done;
 
-  /* Set OFS to offset of free slot.
-     If there are no free slots, then it will be set to the
-     current end-of-file.
-     
-     inode_read_at() will only return a short read at end of file.
-     Otherwise, we'd need to verify that we didn't get a short
-     read due to something intermittent such as low memory. */
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e) 
-    if (!e.in_use)
-      break;
-
-  /* Write slot. */
+  /* Double the table if the new entry makes it too full. If that
+     fails the directory is left as it was and the entry still goes
+     into the current table, unless it has no free slot. */
+  if (inode_read_at (dir->inode, &entry_cnt, sizeof entry_cnt, cnt_ofs)
+      != sizeof entry_cnt)
+    goto done;
+  if ((entry_cnt + 1) * 100
+      > bucket_count (dir->inode) * BUCKET_ENTRIES * DIR_MAX_LOAD_PCT)
+    grow (dir);
+
+  /* Write slot and count. */
   e.in_use = true;
   strlcpy (e.name, name, sizeof e.name);
   e.inode_sector = inode_sector;
-  success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+  if (!insert_entry (dir->inode, bucket_count (dir->inode), &e))
+    goto done;
+  entry_cnt++;
+  success = (inode_write_at (dir->inode, &entry_cnt, sizeof entry_cnt,
+                             cnt_ofs) == sizeof entry_cnt);
+  if (success)
+    dcache_insert (inode_get_inumber (dir->inode), name, inode_sector);
 
  done:
   return success;
@@ -186,6 +292,8 @@ dir_remove (struct dir *dir, const char *name)
 {
   struct dir_entry e;
   struct inode *inode = NULL;
+  uint32_t entry_cnt;
+  off_t cnt_ofs = offsetof (struct dir_bucket, entry_cnt);
   bool success = false;
   off_t ofs;
 
@@ -201,10 +309,23 @@ dir_remove (struct dir *dir, const char *name)
   if (inode == NULL)
     goto done;
 
-  /* Erase directory entry. */
+  /* Erase directory entry. The bucket stays marked as overflowed
+     if it was, until the table is rehashed. */
   e.in_use = false;
   if (inode_write_at (dir->inode, &e, sizeof e, ofs) != sizeof e) 
     goto done;
+  if (inode_read_at (dir->inode, &entry_cnt, sizeof entry_cnt, cnt_ofs)
+      != sizeof entry_cnt)
+    goto done;
+  entry_cnt--;
+  if (inode_write_at (dir->inode, &entry_cnt, sizeof entry_cnt, cnt_ofs)
+      != sizeof entry_cnt)
+    goto done;
+
+  /* Forget cached entries for NAME and, in case the inode is a
+     directory whose sector is reused, in it. */
+  dcache_remove (inode_get_inumber (dir->inode), name);
+  dcache_purge (e.inode_sector);
 
   /* Remove inode. */
   inode_remove (inode);
@@ -222,10 +343,16 @@ bool
 dir_readdir (struct dir *dir, char name[NAME_MAX + 1])
 {
   struct dir_entry e;
+  size_t slot_cnt = bucket_count (dir->inode) * BUCKET_ENTRIES;
 
-  while (inode_read_at (dir->inode, &e, sizeof e, dir->pos) == sizeof e) 
+  while ((size_t) dir->pos < slot_cnt)
     {
-      dir->pos += sizeof e;
+      off_t ofs = entry_ofs (dir->pos / BUCKET_ENTRIES,
+                             dir->pos % BUCKET_ENTRIES);
+
+      dir->pos++;
+      if (inode_read_at (dir->inode, &e, sizeof e, ofs) != sizeof e)
+        break;
       if (e.in_use)
         {
           strlcpy (name, e.name, NAME_MAX + 1);
@@ -234,3 +361,251 @@ dir_readdir (struct dir *dir, char name[NAME_MAX + 1])
     }
   return false;
 }
+
+/* Returns the number of buckets of directory INODE. */
+static size_t
+bucket_count (struct inode *inode)
+{
+  return inode_length (inode) / BLOCK_SECTOR_SIZE;
+}
+
+/* Returns the bucket NAME belongs in, in a table of BUCKET_CNT
+   buckets. */
+static size_t
+home_bucket (const char *name, size_t bucket_cnt)
+{
+  return hash_string (name) % bucket_cnt;
+}
+
+/* Returns the byte offset of entry SLOT of bucket IDX. */
+static off_t
+entry_ofs (size_t idx, size_t slot)
+{
+  return idx * BLOCK_SECTOR_SIZE + slot * sizeof (struct dir_entry);
+}
+
+/* Reads bucket IDX of directory INODE into B. Returns true if
+   successful, false on a short read. */
+static bool
+read_bucket (struct inode *inode, size_t idx, struct dir_bucket *b)
+{
+  return inode_read_at (inode, b, sizeof *b, idx * BLOCK_SECTOR_SIZE)
+         == sizeof *b;
+}
+
+/* Puts E in the first free entry at or after its home bucket in
+   the table of BUCKET_CNT buckets in INODE, marking the full
+   buckets it passes as overflowed. Doesn't update the entry
+   count. Returns true if successful, false if the table is full
+   or a disk error occurs. */
+static bool
+insert_entry (struct inode *inode, size_t bucket_cnt,
+              const struct dir_entry *e)
+{
+  struct dir_bucket b;
+  size_t idx = home_bucket (e->name, bucket_cnt);
+  size_t i, j;
+
+  for (i = 0; i < bucket_cnt && read_bucket (inode, idx, &b); i++)
+    {
+      for (j = 0; j < BUCKET_ENTRIES; j++)
+        if (!b.entries[j].in_use)
+          return inode_write_at (inode, e, sizeof *e, entry_ofs (idx, j))
+                 == sizeof *e;
+
+      if (!b.overflow)
+        {
+          off_t ofs = idx * BLOCK_SECTOR_SIZE
+                      + offsetof (struct dir_bucket, overflow);
+
+          b.overflow = true;
+          if (inode_write_at (inode, &b.overflow, sizeof b.overflow, ofs)
+              != sizeof b.overflow)
+            return false;
+        }
+      idx = (idx + 1) % bucket_cnt;
+    }
+  return false;
+}
+
+/* Doubles the number of buckets of DIR and rehashes its entries.
+   The entries are first inserted into a temporary inode of the
+   new size, which is then copied over the directory, so only one
+   bucket needs to be in memory at a time. The directory is 
+   extended to the new size before any bucket is overwritten, so
+   a full disk leaves it as it was. Returns true if successful, 
+   false on failure. */
+static bool
+grow (struct dir *dir) 
+{
+  size_t old_cnt = bucket_count (dir->inode);
+  size_t new_cnt = old_cnt * 2;
+  block_sector_t sector = 0;
+  struct inode *tmp = NULL;
+  struct dir_bucket *b;
+  bool success = false;
+  uint32_t entry_cnt = 0;
+  size_t i, j;
+
+  b = malloc (sizeof *b);
+  if (b == NULL)
+    return false;
+  if (!free_map_allocate (1, &sector)
+      || !inode_create (sector, new_cnt * BLOCK_SECTOR_SIZE))
+    goto done;
+  tmp = inode_open (sector);
+  if (tmp == NULL)
+    goto done;
+
+  /* Rehash into the temporary inode. */
+  for (i = 0; i < old_cnt; i++)
+    {
+      if (!read_bucket (dir->inode, i, b))
+        goto done;
+      if (i == 0)
+        entry_cnt = b->entry_cnt;
+      for (j = 0; j < BUCKET_ENTRIES; j++)
+        if (b->entries[j].in_use
+            && !insert_entry (tmp, new_cnt, &b->entries[j]))
+          goto done;
+    }
+
+  /* Copy it over the directory, the last bucket first, which 
+     extends the directory. */
+  for (i = new_cnt; i-- > 0; )
+    {
+      if (!read_bucket (tmp, i, b))
+        goto done;
+      if (i == 0)
+        b->entry_cnt = entry_cnt;
+      if (inode_write_at (dir->inode, b, sizeof *b, i * BLOCK_SECTOR_SIZE)
+          != sizeof *b)
+        goto done;
+    }
+  success = true;
+
+ done:
+  if (tmp != NULL)
+    {
+      inode_remove (tmp);
+      inode_close (tmp);
+    }
+  else if (sector != 0)
+    free_map_release (sector, 1);
+  free (b);
+  return success;
+}
+
+/* Looks up NAME in the directory at DIR_SECTOR in the cache. If
+   it is there, stores the sector of its inode in *INODE_SECTOR
+   and returns true, otherwise returns false. */
+static bool
+dcache_lookup (block_sector_t dir_sector, const char *name,
+               block_sector_t *inode_sector) 
+{
+  struct dcache_entry key;
+  struct hash_elem *e;
+
+  key.dir_sector = dir_sector;
+  strlcpy (key.name, name, sizeof key.name);
+
+  lock_acquire (&dcache_lock);
+  e = hash_find (&dcache_map, &key.hash_elem);
+  if (e != NULL)
+    {
+      struct dcache_entry *d = hash_entry (e, struct dcache_entry, hash_elem);
+      *inode_sector = d->inode_sector;
+      list_remove (&d->lru_elem);
+      list_push_front (&dcache_lru, &d->lru_elem);
+    }
+  lock_release (&dcache_lock);
+  return e != NULL;
+}
+
+/* Caches that NAME in the directory at DIR_SECTOR names the inode
+   at INODE_SECTOR, replacing the least recently used entry. */
+static void
+dcache_insert (block_sector_t dir_sector, const char *name,
+               block_sector_t inode_sector) 
+{
+  struct dcache_entry *d;
+
+  lock_acquire (&dcache_lock);
+  d = list_entry (list_back (&dcache_lru), struct dcache_entry, lru_elem);
+  if (d->valid)
+    hash_delete (&dcache_map, &d->hash_elem);
+  d->dir_sector = dir_sector;
+  strlcpy (d->name, name, sizeof d->name);
+  d->inode_sector = inode_sector;
+  d->valid = hash_insert (&dcache_map, &d->hash_elem) == NULL;
+  list_remove (&d->lru_elem);
+  if (d->valid)
+    list_push_front (&dcache_lru, &d->lru_elem);
+  else
+    list_push_back (&dcache_lru, &d->lru_elem);
+  lock_release (&dcache_lock);
+}
+
+/* Drops the cached entry for NAME in the directory at DIR_SECTOR,
+   if any. */
+static void
+dcache_remove (block_sector_t dir_sector, const char *name) 
+{
+  struct dcache_entry key;
+  struct hash_elem *e;
+
+  key.dir_sector = dir_sector;
+  strlcpy (key.name, name, sizeof key.name);
+
+  lock_acquire (&dcache_lock);
+  e = hash_delete (&dcache_map, &key.hash_elem);
+  if (e != NULL)
+    {
+      struct dcache_entry *d = hash_entry (e, struct dcache_entry, hash_elem);
+      d->valid = false;
+      list_remove (&d->lru_elem);
+      list_push_back (&dcache_lru, &d->lru_elem);
+    }
+  lock_release (&dcache_lock);
+}
+
+/* Drops all cached entries in the directory at DIR_SECTOR. */
+static void
+dcache_purge (block_sector_t dir_sector) 
+{
+  size_t i;
+
+  lock_acquire (&dcache_lock);
+  for (i = 0; i < DCACHE_SIZE; i++)
+    if (dcache[i].valid && dcache[i].dir_sector == dir_sector)
+      {
+        hash_delete (&dcache_map, &dcache[i].hash_elem);
+        dcache[i].valid = false;
+        list_remove (&dcache[i].lru_elem);
+        list_push_back (&dcache_lru, &dcache[i].lru_elem);
+      }
+  lock_release (&dcache_lock);
+}
+
+/* Returns a hash value for directory cache entry E. */
+static unsigned
+dcache_hash (const struct hash_elem *e, void *aux UNUSED) 
+{
+  const struct dcache_entry *d = hash_entry (e, struct dcache_entry,
+                                             hash_elem);
+  return hash_string (d->name) ^ hash_int (d->dir_sector);
+}
+
+/* Returns true if directory cache entry A precedes entry B. */
+static bool
+dcache_less (const struct hash_elem *a_, const struct hash_elem *b_,
+                  void *aux UNUSED) 
+{
+  const struct dcache_entry *a = hash_entry (a_, struct dcache_entry,
+                                             hash_elem);
+  const struct dcache_entry *b = hash_entry (b_, struct dcache_entry,
+                                             hash_elem);
+  if (a->dir_sector != b->dir_sector)
+    return a->dir_sector < b->dir_sector;
+  return strcmp (a->name, b->name) < 0;
+}
@@ -1,13 +1,28 @@
 #include "filesys/free-map.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <round.h>
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "threads/synch.h"
+
+/* Free map bits per sector of the free map file. */
+#define BITS_PER_SECTOR (BLOCK_SECTOR_SIZE * 8)
 
 static struct file *free_map_file;   /* Free map file. */
 static struct bitmap *free_map;      /* Free map, one bit per sector. */
 
+/* Changes to the free map are only written to its file by
+   free_map_flush. Until then the sectors of the file holding the
+   changed bits are marked in DIRTY_MAP. Allocation searches
+   next-fit from NEXT_FIT rather than from sector 0. */
+static struct bitmap *dirty_map;
+static size_t next_fit;
+static struct lock free_map_lock;
+
+static void mark_dirty (block_sector_t, size_t);
+
 /* Initializes the free map. */
 void
 free_map_init (void) 
@@ -17,26 +32,33 @@ free_map_init (void)
     PANIC ("bitmap creation failed--file system device is too large");
   bitmap_mark (free_map, FREE_MAP_SECTOR);
   bitmap_mark (free_map, ROOT_DIR_SECTOR);
+  dirty_map = bitmap_create (DIV_ROUND_UP (bitmap_size (free_map),
+                                           BITS_PER_SECTOR));
+  if (dirty_map == NULL)
+    PANIC ("bitmap creation failed--file system device is too large");
+  lock_init (&free_map_lock);
 }
 
 /* Allocates CNT consecutive sectors from the free map and stores
    the first into *SECTORP.
    Returns true if successful, false if not enough consecutive
-   sectors were available or if the free_map file could not be
-   written. */
+   sectors were available. */
 bool
 free_map_allocate (size_t cnt, block_sector_t *sectorp)
 {
-  block_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
-  if (sector != BITMAP_ERROR
-      && free_map_file != NULL
-      && !bitmap_write (free_map, free_map_file))
+  block_sector_t sector;
+
+  lock_acquire (&free_map_lock);
+  sector = bitmap_scan_and_flip (free_map, next_fit, cnt, false);
+  if (sector == BITMAP_ERROR && next_fit > 0)
+    sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
+  if (sector != BITMAP_ERROR)
     {
-      bitmap_set_multiple (free_map, sector, cnt, false); 
-      sector = BITMAP_ERROR;
+      mark_dirty (sector, cnt);
+      next_fit = (sector + cnt) % bitmap_size (free_map);
+      *sectorp = sector;
     }
-  if (sector != BITMAP_ERROR)
-    *sectorp = sector;
+  lock_release (&free_map_lock);
   return sector != BITMAP_ERROR;
 }
 
@@ -44,9 +66,34 @@ free_map_allocate (size_t cnt, block_sector_t *sectorp)
 void
 free_map_release (block_sector_t sector, size_t cnt)
 {
+  lock_acquire (&free_map_lock);
   ASSERT (bitmap_all (free_map, sector, cnt));
   bitmap_set_multiple (free_map, sector, cnt, false);
-  bitmap_write (free_map, free_map_file);
+  mark_dirty (sector, cnt);
+  lock_release (&free_map_lock);
+}
+
+/* Writes the sectors of the free map file holding bits changed
+   since the last flush. Called by the buffer cache flusher and
+   when the free map is closed. */
+void
+free_map_flush (void)
+{
+  size_t i;
+
+  lock_acquire (&free_map_lock);
+  for (i = 0; free_map_file != NULL && i < bitmap_size (dirty_map); i++)
+    if (bitmap_test (dirty_map, i))
+      {
+        size_t start = i * BITS_PER_SECTOR;
+        size_t cnt = bitmap_size (free_map) - start < BITS_PER_SECTOR
+                     ? bitmap_size (free_map) - start : BITS_PER_SECTOR;
+
+        if (!bitmap_write_range (free_map, free_map_file, start, cnt))
+          PANIC ("can't write free map");
+        bitmap_reset (dirty_map, i);
+      }
+  lock_release (&free_map_lock);
 }
 
 /* Opens the free map file and reads it from disk. */
@@ -64,7 +111,11 @@ free_map_open (void)
 void
 free_map_close (void) 
 {
+  free_map_flush ();
+  lock_acquire (&free_map_lock);
   file_close (free_map_file);
+  free_map_file = NULL;
+  lock_release (&free_map_lock);
 }
 
 /* Creates a new free map file on disk and writes the free map to
@@ -82,4 +133,18 @@ free_map_create (void)
     PANIC ("can't open free map");
   if (!bitmap_write (free_map, free_map_file))
     PANIC ("can't write free map");
+  bitmap_set_all (dirty_map, false);
+}
+
+/* Marks the sectors of the free map file that hold the CNT bits
+   starting at SECTOR as dirty. The caller must hold
+   free_map_lock. */
+static void
+mark_dirty (block_sector_t sector, size_t cnt)
+{
+  size_t first = sector / BITS_PER_SECTOR;
+  size_t last = (sector + cnt - 1) / BITS_PER_SECTOR;
+
+  if (cnt > 0)
+    bitmap_set_multiple (dirty_map, first, last - first + 1, true);
 }
@@ -1,8 +1,10 @@
 #include "filesys/inode.h"
+#include <hash.h>
 #include <list.h>
 #include <debug.h>
 #include <round.h>
 #include <string.h>
+#include "filesys/cache.h"
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
 #include "threads/malloc.h"
@@ -10,14 +12,30 @@
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
 
+/* Data sectors indexed straight from the inode, and sector numbers
+   held by an index sector. */
+#define DIRECT_CNT 124
+#define INDEX_CNT (BLOCK_SECTOR_SIZE / sizeof (block_sector_t))
+
+/* Most data sectors allocated as one run when a file grows. */
+#define INODE_CLUSTER 8
+
+/* Most closed inodes kept in memory for a quick reopen. */
+#define INODE_CACHE_SIZE 16
+
 /* On-disk inode.
-   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+   Must be exactly BLOCK_SECTOR_SIZE bytes long. Data sector I of
+   the file is direct[I] for the first DIRECT_CNT ones, then entry
+   I - DIRECT_CNT of the indirect sector, then an entry of one of the
+   sectors listed by the doubly indirect sector. Sector 0 holds the 
+   free map inode, so 0 marks a sector not allocated yet. */
 struct inode_disk
   {
-    block_sector_t start;               /* First data sector. */
     off_t length;                       /* File size in bytes. */
     unsigned magic;                     /* Magic number. */
-    uint32_t unused[125];               /* Not used. */
+    block_sector_t direct[DIRECT_CNT];  /* Direct data sectors. */
+    block_sector_t indirect;            /* Indirect index sector. */
+    block_sector_t doubly_indirect;     /* Doubly indirect index sector. */
   };
 
 /* Returns the number of sectors to allocate for an inode SIZE
@@ -31,14 +49,104 @@ bytes_to_sectors (off_t size)
 /* In-memory inode. */
 struct inode 
   {
-    struct list_elem elem;              /* Element in inode list. */
+    struct hash_elem elem;              /* Element in inode table. */
+    struct list_elem closed_elem;       /* Element in closed inode list. */
     block_sector_t sector;              /* Sector number of disk location. */
     int open_cnt;                       /* Number of openers. */
     bool removed;                       /* True if deleted, false otherwise. */
     int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
+    off_t read_end;                     /* Offset the last read ended at. */
     struct inode_disk data;             /* Inode content. */
   };
 
+static bool inode_extend (struct inode_disk *, off_t length);
+static void inode_release (struct inode_disk *);
+
+/* Returns entry IDX of index sector SECTOR. */
+static block_sector_t
+index_get (block_sector_t sector, size_t idx)
+{
+  block_sector_t entry;
+
+  cache_read (sector, &entry, idx * sizeof entry, sizeof entry);
+  return entry;
+}
+
+/* Sets entry IDX of index sector SECTOR to ENTRY. */
+static void
+index_set (block_sector_t sector, size_t idx, block_sector_t entry)
+{
+  cache_write (sector, &entry, idx * sizeof entry, sizeof entry);
+}
+
+/* Returns data sector IDX of DISK, or 0 if it is not allocated. */
+static block_sector_t
+disk_get_sector (const struct inode_disk *disk, size_t idx)
+{
+  block_sector_t l1;
+
+  if (idx < DIRECT_CNT)
+    return disk->direct[idx];
+  idx -= DIRECT_CNT;
+  if (idx < INDEX_CNT)
+    return disk->indirect != 0 ? index_get (disk->indirect, idx) : 0;
+  idx -= INDEX_CNT;
+  if (idx >= INDEX_CNT * INDEX_CNT || disk->doubly_indirect == 0)
+    return 0;
+  l1 = index_get (disk->doubly_indirect, idx / INDEX_CNT);
+  return l1 != 0 ? index_get (l1, idx % INDEX_CNT) : 0;
+}
+
+/* Allocates a zeroed index sector and stores it in *SECTORP.
+   Returns false if the disk is full. */
+static bool
+alloc_index (block_sector_t *sectorp)
+{
+  static char zeros[BLOCK_SECTOR_SIZE];
+
+  if (!free_map_allocate (1, sectorp))
+    return false;
+  cache_write (*sectorp, zeros, 0, BLOCK_SECTOR_SIZE);
+  return true;
+}
+
+/* Makes SECTOR data sector IDX of DISK, allocating the index sectors
+   on the way. Returns false if the file would be too large or an
+   index sector can't be allocated. */
+static bool
+disk_set_sector (struct inode_disk *disk, size_t idx, block_sector_t sector)
+{
+  block_sector_t l1;
+
+  if (idx < DIRECT_CNT)
+    {
+      disk->direct[idx] = sector;
+      return true;
+    }
+  idx -= DIRECT_CNT;
+  if (idx < INDEX_CNT)
+    {
+      if (disk->indirect == 0 && !alloc_index (&disk->indirect))
+        return false;
+      index_set (disk->indirect, idx, sector);
+      return true;
+    }
+  idx -= INDEX_CNT;
+  if (idx >= INDEX_CNT * INDEX_CNT)
+    return false;
+  if (disk->doubly_indirect == 0 && !alloc_index (&disk->doubly_indirect))
+    return false;
+  l1 = index_get (disk->doubly_indirect, idx / INDEX_CNT);
+  if (l1 == 0)
+    {
+      if (!alloc_index (&l1))
+        return false;
+      index_set (disk->doubly_indirect, idx / INDEX_CNT, l1);
+    }
+  index_set (l1, idx % INDEX_CNT, sector);
+  return true;
+}
+
 /* Returns the block device sector that contains byte offset POS
    within INODE.
    Returns -1 if INODE does not contain data for a byte at offset
@@ -48,20 +156,31 @@ byte_to_sector (const struct inode *inode, off_t pos)
 {
   ASSERT (inode != NULL);
   if (pos < inode->data.length)
-    return inode->data.start + pos / BLOCK_SECTOR_SIZE;
+    return disk_get_sector (&inode->data, pos / BLOCK_SECTOR_SIZE);
   else
     return -1;
 }
 
-/* List of open inodes, so that opening a single inode twice
-   returns the same `struct inode'. */
-static struct list open_inodes;
+/* Table of open inodes keyed by sector, so that opening a single
+   inode twice returns the same `struct inode'. It also holds the
+   INODE_CACHE_SIZE most recently closed inodes that weren't
+   removed, which are on closed_inodes, most recent first, and
+   have an open_cnt of 0. Reopening one of them doesn't have to
+   read its sector again. */
+static struct hash open_inodes;
+static struct list closed_inodes;
+static size_t closed_cnt;
+
+static unsigned inode_hash (const struct hash_elem *, void *);
+static bool inode_less (const struct hash_elem *, const struct hash_elem *,
+                        void *);
 
 /* Initializes the inode module. */
 void
 inode_init (void) 
 {
-  list_init (&open_inodes);
+  hash_init (&open_inodes, inode_hash, inode_less, NULL);
+  list_init (&closed_inodes);
 }
 
 /* Initializes an inode with LENGTH bytes of data and
@@ -84,22 +203,15 @@ inode_create (block_sector_t sector, off_t length)
   disk_inode = calloc (1, sizeof *disk_inode);
   if (disk_inode != NULL)
     {
-      size_t sectors = bytes_to_sectors (length);
-      disk_inode->length = length;
       disk_inode->magic = INODE_MAGIC;
-      if (free_map_allocate (sectors, &disk_inode->start)) 
+      if (inode_extend (disk_inode, length)) 
         {
-          block_write (fs_device, sector, disk_inode);
-          if (sectors > 0) 
-            {
-              static char zeros[BLOCK_SECTOR_SIZE];
-              size_t i;
-              
-              for (i = 0; i < sectors; i++) 
-                block_write (fs_device, disk_inode->start + i, zeros);
-            }
+          disk_inode->length = length;
+          cache_write (sector, disk_inode, 0, BLOCK_SECTOR_SIZE);
           success = true; 
         } 
+      else
+        inode_release (disk_inode);
       free (disk_inode);
     }
   return success;
@@ -111,19 +223,25 @@ inode_create (block_sector_t sector, off_t length)
 struct inode *
 inode_open (block_sector_t sector)
 {
-  struct list_elem *e;
+  struct inode key;
+  struct hash_elem *e;
   struct inode *inode;
 
-  /* Check whether this inode is already open. */
-  for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-       e = list_next (e)) 
+  /* Check whether this inode is already open or was closed
+     recently. */
+  key.sector = sector;
+  e = hash_find (&open_inodes, &key.elem);
+  if (e != NULL)
     {
-      inode = list_entry (e, struct inode, elem);
-      if (inode->sector == sector) 
+      inode = hash_entry (e, struct inode, elem);
+      if (inode->open_cnt == 0)
         {
-          inode_reopen (inode);
-          return inode; 
+          list_remove (&inode->closed_elem);
+          closed_cnt--;
+          inode->read_end = 0;
         }
+      inode_reopen (inode);
+      return inode; 
     }
 
   /* Allocate memory. */
@@ -132,12 +250,13 @@ inode_open (block_sector_t sector)
     return NULL;
 
   /* Initialize. */
-  list_push_front (&open_inodes, &inode->elem);
   inode->sector = sector;
+  hash_insert (&open_inodes, &inode->elem);
   inode->open_cnt = 1;
   inode->deny_write_cnt = 0;
   inode->removed = false;
-  block_read (fs_device, inode->sector, &inode->data);
+  inode->read_end = 0;
+  cache_read (inode->sector, &inode->data, 0, BLOCK_SECTOR_SIZE);
   return inode;
 }
 
@@ -158,8 +277,11 @@ inode_get_inumber (const struct inode *inode)
 }
 
 /* Closes INODE and writes it to disk.
-   If this was the last reference to INODE, frees its memory.
-   If INODE was also a removed inode, frees its blocks. */
+   If this was the last reference to INODE, keeps it among the
+   recently closed inodes, freeing the memory of the least 
+   recently closed one if there are too many.
+   If INODE was also a removed inode, frees its memory and its
+   blocks right away. */
 void
 inode_close (struct inode *inode) 
 {
@@ -170,18 +292,26 @@ inode_close (struct inode *inode)
   /* Release resources if this was the last opener. */
   if (--inode->open_cnt == 0)
     {
-      /* Remove from inode list and release lock. */
-      list_remove (&inode->elem);
- 
       /* Deallocate blocks if removed. */
       if (inode->removed) 
         {
+          hash_delete (&open_inodes, &inode->elem);
           free_map_release (inode->sector, 1);
-          free_map_release (inode->data.start,
-                            bytes_to_sectors (inode->data.length)); 
+          inode_release (&inode->data);
+          free (inode); 
+          return;
         }
 
-      free (inode); 
+      /* Keep it for a quick reopen. */
+      list_push_front (&closed_inodes, &inode->closed_elem);
+      if (++closed_cnt > INODE_CACHE_SIZE)
+        {
+          struct inode *victim = list_entry (list_pop_back (&closed_inodes),
+                                             struct inode, closed_elem);
+          closed_cnt--;
+          hash_delete (&open_inodes, &victim->elem);
+          free (victim);
+        }
     }
 }
 
@@ -196,13 +326,15 @@ inode_remove (struct inode *inode)
 
 /* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
    Returns the number of bytes actually read, which may be less
-   than SIZE if an error occurs or end of file is reached. */
+   than SIZE if an error occurs or end of file is reached. A read
+   that starts where the previous one ended has the sector that 
+   follows it read ahead. */
 off_t
 inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) 
 {
   uint8_t *buffer = buffer_;
   off_t bytes_read = 0;
-  uint8_t *bounce = NULL;
+  bool sequential = offset == inode->read_end;
 
   while (size > 0) 
     {
@@ -220,51 +352,48 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
       if (chunk_size <= 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
-        {
-          /* Read full sector directly into caller's buffer. */
-          block_read (fs_device, sector_idx, buffer + bytes_read);
-        }
-      else 
-        {
-          /* Read sector into bounce buffer, then partially copy
-             into caller's buffer. */
-          if (bounce == NULL) 
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
-          block_read (fs_device, sector_idx, bounce);
-          memcpy (buffer + bytes_read, bounce + sector_ofs, chunk_size);
-        }
+      cache_read (sector_idx, buffer + bytes_read, sector_ofs, chunk_size);
       
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_read += chunk_size;
     }
-  free (bounce);
+
+  inode->read_end = offset;
+  if (sequential && bytes_read > 0 
+      && ROUND_UP (offset, BLOCK_SECTOR_SIZE) < inode_length (inode))
+    cache_readahead (byte_to_sector (inode, 
+                                     ROUND_UP (offset, BLOCK_SECTOR_SIZE)));
 
   return bytes_read;
 }
 
 /* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
    Returns the number of bytes actually written, which may be
-   less than SIZE if end of file is reached or an error occurs.
-   (Normally a write at end of file would extend the inode, but
-   growth is not yet implemented.) */
+   less than SIZE if an error occurs. A write past end of file 
+   extends the inode first, the bytes between the old end and 
+   OFFSET read as zeros. If the disk is full nothing is written 
+   past the old end. */
 off_t
 inode_write_at (struct inode *inode, const void *buffer_, off_t size,
                 off_t offset) 
 {
   const uint8_t *buffer = buffer_;
   off_t bytes_written = 0;
-  uint8_t *bounce = NULL;
 
   if (inode->deny_write_cnt)
     return 0;
 
+  if (size > 0 && offset + size > inode->data.length)
+    {
+      /* Also store the sectors a failed extension allocated, so 
+         they are freed with the inode. */
+      if (inode_extend (&inode->data, offset + size))
+        inode->data.length = offset + size;
+      cache_write (inode->sector, &inode->data, 0, BLOCK_SECTOR_SIZE);
+    }
+
   while (size > 0) 
     {
       /* Sector to write, starting byte offset within sector. */
@@ -281,40 +410,104 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
       if (chunk_size <= 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
+      /* The cache reads the sector in first unless the chunk 
+         covers all of it. */
+      cache_write (sector_idx, buffer + bytes_written, sector_ofs, 
+                   chunk_size);
+
+      /* Advance. */
+      size -= chunk_size;
+      offset += chunk_size;
+      bytes_written += chunk_size;
+    }
+
+  return bytes_written;
+}
+
+/* Allocates zeroed data sectors for DISK to hold LENGTH bytes. The
+   sectors are allocated INODE_CLUSTER at a time where the free map
+   has such runs, so files stay mostly contiguous. Sectors left over
+   by an extension that failed are reused. Doesn't change DISK's 
+   length. Returns false if the disk is full, the caller then keeps
+   the old length and inode_release frees all of DISK's sectors. */
+static bool
+inode_extend (struct inode_disk *disk, off_t length)
+{
+  static char zeros[BLOCK_SECTOR_SIZE];
+  size_t idx = bytes_to_sectors (disk->length);
+  size_t sectors = bytes_to_sectors (length);
+
+  while (idx < sectors)
+    {
+      size_t cnt = sectors - idx < INODE_CLUSTER ? sectors - idx 
+                                                 : INODE_CLUSTER;
+      block_sector_t start;
+      size_t i;
+
+      if (disk_get_sector (disk, idx) != 0)
         {
-          /* Write full sector directly to disk. */
-          block_write (fs_device, sector_idx, buffer + bytes_written);
+          idx++;
+          continue;
         }
-      else 
+
+      /* Take the longest run up to CNT sectors we can get. */
+      while (!free_map_allocate (cnt, &start))
+        if (--cnt == 0)
+          return false;
+
+      for (i = 0; i < cnt; i++)
         {
-          /* We need a bounce buffer. */
-          if (bounce == NULL) 
+          cache_write (start + i, zeros, 0, BLOCK_SECTOR_SIZE);
+          if (!disk_set_sector (disk, idx + i, start + i))
             {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
+              free_map_release (start + i, cnt - i);
+              return false;
             }
-
-          /* If the sector contains data before or after the chunk
-             we're writing, then we need to read in the sector
-             first.  Otherwise we start with a sector of all zeros. */
-          if (sector_ofs > 0 || chunk_size < sector_left) 
-            block_read (fs_device, sector_idx, bounce);
-          else
-            memset (bounce, 0, BLOCK_SECTOR_SIZE);
-          memcpy (bounce + sector_ofs, buffer + bytes_written, chunk_size);
-          block_write (fs_device, sector_idx, bounce);
         }
+      idx += cnt;
+    }
+  return true;
+}
 
-      /* Advance. */
-      size -= chunk_size;
-      offset += chunk_size;
-      bytes_written += chunk_size;
+/* Frees the data and index sectors of DISK, including any allocated
+   past its length. */
+static void
+inode_release (struct inode_disk *disk)
+{
+  size_t i, j;
+
+  for (i = 0; i < DIRECT_CNT; i++)
+    if (disk->direct[i] != 0)
+      free_map_release (disk->direct[i], 1);
+
+  if (disk->indirect != 0)
+    {
+      for (i = 0; i < INDEX_CNT; i++)
+        {
+          block_sector_t sector = index_get (disk->indirect, i);
+          if (sector != 0)
+            free_map_release (sector, 1);
+        }
+      free_map_release (disk->indirect, 1);
     }
-  free (bounce);
 
-  return bytes_written;
+  if (disk->doubly_indirect != 0)
+    {
+      for (i = 0; i < INDEX_CNT; i++)
+        {
+          block_sector_t l1 = index_get (disk->doubly_indirect, i);
+          if (l1 == 0)
+            continue;
+          for (j = 0; j < INDEX_CNT; j++)
+            {
+              block_sector_t sector = index_get (l1, j);
+              if (sector != 0)
+                free_map_release (sector, 1);
+            }
+          free_map_release (l1, 1);
+        }
+      free_map_release (disk->doubly_indirect, 1);
+    }
 }
 
 /* Disables writes to INODE.
@@ -352,3 +545,21 @@ inode_get_block_number (const struct inode *inode, off_t offset)
 {
   return byte_to_sector (inode, offset);
 }
+
+/* Returns a hash value for inode E. */
+static unsigned
+inode_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct inode *inode = hash_entry (e, struct inode, elem);
+  return hash_int (inode->sector);
+}
+
+/* Returns true if inode A precedes inode B. */
+static bool
+inode_less (const struct hash_elem *a_, const struct hash_elem *b_,
+            void *aux UNUSED)
+{
+  const struct inode *a = hash_entry (a_, struct inode, elem);
+  const struct inode *b = hash_entry (b_, struct inode, elem);
+  return a->sector < b->sector;
+}
@@ -359,6 +359,22 @@ bitmap_write (const struct bitmap *b, struct file *file)
   off_t size = byte_cnt (b->bit_cnt);
   return file_write_at (file, b->bits, size, 0) == size;
 }
+
+/* Writes the bytes of B that hold the CNT bits starting at START
+   to the same place in FILE, which holds the rest of B already.
+   Return true if successful, false otherwise. */
+bool
+bitmap_write_range (const struct bitmap *b, struct file *file, 
+                    size_t start, size_t cnt)
+{
+  off_t ofs = start / CHAR_BIT;
+  off_t size = byte_cnt (start + cnt) - ofs;
+
+  ASSERT (start <= b->bit_cnt);
+  ASSERT (cnt <= b->bit_cnt - start);
+
+  return file_write_at (file, (char *) b->bits + ofs, size, ofs) == size;
+}
 #endif /* FILESYS */
 
 /* Debugging. */
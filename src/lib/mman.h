@@ -0,0 +1,13 @@
+#ifndef __LIB_MMAN_H
+#define __LIB_MMAN_H
+
+/* Access hints for the madvise system call. The first three set 
+   how the pages of a mapping are paged in from then on, the last
+   two act on the mapping's pages right away. */
+#define MADV_NORMAL     0       /* Read a few pages around a fault. */
+#define MADV_SEQUENTIAL 1       /* Read far ahead, evict pages behind. */
+#define MADV_RANDOM     2       /* Read only the faulting page. */
+#define MADV_WILLNEED   3       /* Read the pages in the background. */
+#define MADV_DONTNEED   4       /* Write back and drop the pages. */
+
+#endif /* lib/mman.h */
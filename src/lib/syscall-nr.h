@@ -28,7 +28,14 @@ enum
     SYS_MKDIR,                  /* Create a directory. */
     SYS_READDIR,                /* Reads a directory entry. */
     SYS_ISDIR,                  /* Tests if a fd represents a directory. */
-    SYS_INUMBER                 /* Returns the inode number for a fd. */
+    SYS_INUMBER,                /* Returns the inode number for a fd. */
+
+    /* Paging statistics. */
+    SYS_VMSTAT,                 /* Obtain paging statistics. */
+
+    /* Memory mapped file control. */
+    SYS_MSYNC,                  /* Write back a memory mapping. */
+    SYS_MADVISE                 /* Give an access hint for a mapping. */
   };
 
 #endif /* lib/syscall-nr.h */
@@ -153,6 +153,18 @@ munmap (mapid_t mapid)
   syscall1 (SYS_MUNMAP, mapid);
 }
 
+void
+msync (mapid_t mapid)
+{
+  syscall1 (SYS_MSYNC, mapid);
+}
+
+bool
+madvise (mapid_t mapid, int advice)
+{
+  return syscall2 (SYS_MADVISE, mapid, advice);
+}
+
 bool
 chdir (const char *dir)
 {
@@ -182,3 +194,9 @@ inumber (int fd)
 {
   return syscall1 (SYS_INUMBER, fd);
 }
+
+int
+vmstat (struct vmstat *stats)
+{
+  return syscall1 (SYS_VMSTAT, stats);
+}
@@ -3,6 +3,8 @@
 
 #include <stdbool.h>
 #include <debug.h>
+#include <mman.h>
+#include <vmstat.h>
 
 /* Process identifier. */
 typedef int pid_t;
@@ -37,6 +39,8 @@ void close (int fd);
 /* Task 3 and optionally task 4. */
 mapid_t mmap (int fd, void *addr);
 void munmap (mapid_t);
+void msync (mapid_t);
+bool madvise (mapid_t, int advice);
 
 /* Task 4 only. */
 bool chdir (const char *dir);
@@ -45,4 +49,7 @@ bool readdir (int fd, char name[READDIR_MAX_LEN + 1]);
 bool isdir (int fd);
 int inumber (int fd);
 
+/* Paging statistics. */
+int vmstat (struct vmstat *);
+
 #endif /* lib/user/syscall.h */
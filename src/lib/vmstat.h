@@ -0,0 +1,30 @@
+#ifndef __LIB_VMSTAT_H
+#define __LIB_VMSTAT_H
+
+#include <stdint.h>
+
+/* Buckets of the page fault latency histogram. Bucket 0 counts
+   the faults served within the timer tick they happened in,
+   bucket I > 0 the ones that took 2**(I-1) up to 2**I - 1 ticks
+   and the last one all the slower ones. */
+#define VMSTAT_LATENCY_BUCKETS 8
+
+/* Paging statistics returned by the vmstat system call. */
+struct vmstat
+  {
+    /* Of the calling process. */
+    unsigned faults;            /* Page faults handled. */
+    unsigned minor_faults;      /* Page-ins without a disk read. */
+    unsigned major_faults;      /* Page-ins that read the disk. */
+    unsigned stack_faults;      /* Pages added by stack growth. */
+    unsigned swap_ins;          /* Pages read from swap. */
+    unsigned swap_outs;         /* Pages written to swap. */
+    unsigned file_writes;       /* Pages written back to files. */
+    unsigned evictions;         /* Pages evicted. */
+    int64_t load_ticks;         /* Timer ticks spent loading pages. */
+
+    /* Of all processes. */
+    unsigned latency[VMSTAT_LATENCY_BUCKETS];
+  };
+
+#endif /* lib/vmstat.h */
@@ -0,0 +1,40 @@
+/* Child process of page-fault-par.
+   Touches each page of a 512 kB buffer once per round, writing
+   in the even rounds and checking in the odd ones, so nearly
+   every access is a page fault when several of these run at
+   once and memory is tight. */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+const char *test_name = "child-fault";
+
+#define PAGE_SIZE 4096
+#define PAGE_CNT 128
+#define ROUNDS 8
+
+static uint8_t buf[PAGE_CNT * PAGE_SIZE];
+
+int
+main (int argc, char *argv[])
+{
+  int id = argc > 1 ? atoi (argv[1]) : 0;
+  size_t i;
+  int round;
+
+  for (round = 0; round < ROUNDS; round++)
+    for (i = 0; i < PAGE_CNT; i++)
+      {
+        uint8_t value = (uint8_t) (id + round / 2 + i);
+        uint8_t *p = buf + i * PAGE_SIZE + (i * 64) % PAGE_SIZE;
+
+        if (round % 2 == 0)
+          *p = value;
+        else if (*p != value)
+          fail ("page %zu: %d != %d", i, *p, value);
+      }
+
+  return id;
+}
@@ -0,0 +1,50 @@
+/* Writes to a file through a mapping, drops the mapping's pages
+   with MADV_DONTNEED, and reads the data back through the mapping
+   under each of the other access hints to verify. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define ACTUAL ((char *) 0x10000000)
+#define SIZE (16 * 4096)
+
+static void
+verify (const char *hint)
+{
+  size_t i;
+
+  for (i = 0; i < SIZE; i++)
+    if (ACTUAL[i] != (char) (i % 251))
+      fail ("byte %zu of mmap'd region has value %02hhx after %s",
+            i, ACTUAL[i], hint);
+}
+
+void
+test_main (void)
+{
+  int handle;
+  mapid_t map;
+  size_t i;
+
+  CHECK (create ("madvise.dat", SIZE), "create \"madvise.dat\"");
+  CHECK ((handle = open ("madvise.dat")) > 1, "open \"madvise.dat\"");
+  CHECK ((map = mmap (handle, ACTUAL)) != MAP_FAILED, "mmap \"madvise.dat\"");
+  for (i = 0; i < SIZE; i++)
+    ACTUAL[i] = i % 251;
+
+  CHECK (madvise (map, MADV_DONTNEED), "madvise DONTNEED");
+  CHECK (madvise (map, MADV_SEQUENTIAL), "madvise SEQUENTIAL");
+  verify ("MADV_SEQUENTIAL");
+  CHECK (madvise (map, MADV_DONTNEED), "madvise DONTNEED");
+  CHECK (madvise (map, MADV_RANDOM), "madvise RANDOM");
+  verify ("MADV_RANDOM");
+  CHECK (madvise (map, MADV_DONTNEED), "madvise DONTNEED");
+  CHECK (madvise (map, MADV_WILLNEED), "madvise WILLNEED");
+  verify ("MADV_WILLNEED");
+  CHECK (!madvise (map, -1), "madvise with bad hint");
+
+  munmap (map);
+  close (handle);
+}
@@ -0,0 +1,19 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(mmap-madvise) begin
+(mmap-madvise) create "madvise.dat"
+(mmap-madvise) open "madvise.dat"
+(mmap-madvise) mmap "madvise.dat"
+(mmap-madvise) madvise DONTNEED
+(mmap-madvise) madvise SEQUENTIAL
+(mmap-madvise) madvise DONTNEED
+(mmap-madvise) madvise RANDOM
+(mmap-madvise) madvise DONTNEED
+(mmap-madvise) madvise WILLNEED
+(mmap-madvise) madvise with bad hint
+(mmap-madvise) end
+EOF
+pass;
@@ -0,0 +1,39 @@
+/* Writes to a file through a mapping spanning several pages and
+   writes the mapping back with msync, then reads the data in the
+   file back using the read system call while it is still mapped
+   to verify. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define ACTUAL ((void *) 0x10000000)
+#define SIZE (3 * 4096)
+
+static char buf[SIZE];
+
+void
+test_main (void)
+{
+  int handle;
+  mapid_t map;
+  size_t i;
+
+  CHECK (create ("msync.dat", SIZE), "create \"msync.dat\"");
+  CHECK ((handle = open ("msync.dat")) > 1, "open \"msync.dat\"");
+  CHECK ((map = mmap (handle, ACTUAL)) != MAP_FAILED, "mmap \"msync.dat\"");
+
+  /* Write file via mmap and write it back. */
+  for (i = 0; i < SIZE; i++)
+    ((char *) ACTUAL)[i] = i % 251;
+  msync (map);
+  msg ("msync \"msync.dat\"");
+
+  /* Read back via read(). */
+  read (handle, buf, SIZE);
+  CHECK (!memcmp (buf, ACTUAL, SIZE),
+         "compare read data against written data");
+  munmap (map);
+  close (handle);
+}
@@ -0,0 +1,31 @@
+/* Runs 4 child-fault processes at once, which fault on their own
+   pages in parallel. A page fault only synchronizes on the page
+   and frame it works on, so the faults of the different processes
+   overlap instead of waiting for one another while one of them
+   waits for the disk. Compare the timer ticks printed at shutdown
+   with the ticks of the children run one after the other. */
+
+#include <stdio.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define CHILD_CNT 4
+
+void
+test_main (void)
+{
+  pid_t children[CHILD_CNT];
+  int i;
+
+  for (i = 0; i < CHILD_CNT; i++)
+    {
+      char cmd_line[32];
+      snprintf (cmd_line, sizeof cmd_line, "child-fault %d", i);
+      CHECK ((children[i] = exec (cmd_line)) != -1,
+             "exec child %d", i);
+    }
+
+  for (i = 0; i < CHILD_CNT; i++)
+    CHECK (wait (children[i]) == i, "wait for child %d", i);
+}
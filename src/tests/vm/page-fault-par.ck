@@ -0,0 +1,17 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(page-fault-par) begin
+(page-fault-par) exec child 0
+(page-fault-par) exec child 1
+(page-fault-par) exec child 2
+(page-fault-par) exec child 3
+(page-fault-par) wait for child 0
+(page-fault-par) wait for child 1
+(page-fault-par) wait for child 2
+(page-fault-par) wait for child 3
+(page-fault-par) end
+EOF
+pass;
@@ -0,0 +1,48 @@
+/* Touches a known number of untouched pages of zero-initialized
+   data and checks that the paging statistics returned by the
+   vmstat system call count a fault for each of them. */
+
+#include <syscall.h>
+#include <vmstat.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_CNT 16
+
+static char buf[PAGE_CNT * 4096] __attribute__ ((aligned (4096)));
+
+/* Returns the number of faults in the latency histogram of S. */
+static unsigned
+latency_sum (const struct vmstat *s)
+{
+  unsigned sum = 0;
+  int i;
+
+  for (i = 0; i < VMSTAT_LATENCY_BUCKETS; i++)
+    sum += s->latency[i];
+  return sum;
+}
+
+void
+test_main (void)
+{
+  struct vmstat before, after;
+  size_t i;
+
+  CHECK (vmstat (&before) == 0, "vmstat before touching the pages");
+  for (i = 0; i < PAGE_CNT; i++)
+    buf[i * 4096] = 1;
+  CHECK (vmstat (&after) == 0, "vmstat after touching the pages");
+
+  CHECK (after.faults - before.faults >= PAGE_CNT,
+         "faults counted for each page");
+  CHECK ((after.minor_faults + after.major_faults)
+         - (before.minor_faults + before.major_faults) >= PAGE_CNT,
+         "page-ins counted for each page");
+  CHECK (after.swap_outs >= before.swap_outs
+         && after.evictions >= before.evictions
+         && after.load_ticks >= before.load_ticks,
+         "counters never go backwards");
+  CHECK (latency_sum (&after) - latency_sum (&before) >= PAGE_CNT,
+         "latency histogram counts each fault");
+}
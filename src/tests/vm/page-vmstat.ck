@@ -0,0 +1,15 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(page-vmstat) begin
+(page-vmstat) vmstat before touching the pages
+(page-vmstat) vmstat after touching the pages
+(page-vmstat) faults counted for each page
+(page-vmstat) page-ins counted for each page
+(page-vmstat) counters never go backwards
+(page-vmstat) latency histogram counts each fault
+(page-vmstat) end
+EOF
+pass;
@@ -41,11 +41,15 @@
 #ifdef VM
 #include "vm/swap.h"
 #include "vm/mmap.h"
+#include "vm/zswap.h"
 #endif
 
 /* Page directory with kernel mappings only. */
 uint32_t *init_page_dir;
 
+/* Number of large pages in the kernel virtual mapping. */
+size_t init_large_pages;
+
 #ifdef FILESYS
 /* -f: Format the file system? */
 static bool format_filesys;
@@ -64,6 +68,7 @@ static size_t user_page_limit = SIZE_MAX;
 
 static void bss_init (void);
 static void paging_init (void);
+static bool cpu_has_pse (void);
 
 static char **read_command_line (void);
 static char **parse_options (char **argv);
@@ -165,12 +170,18 @@ bss_init (void)
 /* Populates the base page directory and page table with the
    kernel virtual mapping, and then sets up the CPU to use the
    new page directory.  Points init_page_dir to the page
-   directory it creates. */
+   directory it creates.
+
+   If the CPU supports page size extensions, each 4 MB region
+   that lies entirely in RAM and holds no kernel text is mapped
+   by a single large page, which saves its page table and a TLB
+   entry per 4 kB page. */
 static void
 paging_init (void)
 {
   uint32_t *pd, *pt;
   size_t page;
+  bool pse = cpu_has_pse ();
   extern char _start, _end_kernel_text;
 
   pd = init_page_dir = palloc_get_page (PAL_ASSERT | PAL_ZERO);
@@ -183,6 +194,15 @@ paging_init (void)
       size_t pte_idx = pt_no (vaddr);
       bool in_kernel_text = &_start <= vaddr && vaddr < &_end_kernel_text;
 
+      if (pse && pte_idx == 0 && page + LGPG_CNT <= init_ram_pages
+          && (vaddr + LGPGSIZE <= &_start || vaddr >= &_end_kernel_text))
+        {
+          pd[pde_idx] = pde_create_large (vaddr, true, false);
+          init_large_pages++;
+          page += LGPG_CNT - 1;
+          continue;
+        }
+
       if (pd[pde_idx] == 0)
         {
           pt = palloc_get_page (PAL_ASSERT | PAL_ZERO);
@@ -197,9 +217,28 @@ paging_init (void)
      new page tables immediately.  See [IA32-v2a] "MOV--Move
      to/from Control Registers" and [IA32-v3a] 3.7.5 "Base Address
      of the Page Directory". */
+  if (pse)
+    {
+      uint32_t cr4;
+      asm volatile ("movl %%cr4, %0" : "=r" (cr4));
+      asm volatile ("movl %0, %%cr4" : : "r" (cr4 | CR4_PSE));
+    }
   asm volatile ("movl %0, %%cr3" : : "r" (vtop (init_page_dir)));
 }
 
+/* Returns true if the CPU supports page size extensions, that is
+   4 MB pages.  See [IA32-v2a] "CPUID--CPU Identification". */
+static bool
+cpu_has_pse (void)
+{
+  uint32_t eax, ebx, ecx, edx;
+
+  asm volatile ("cpuid"
+                : "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx)
+                : "a" (1));
+  return (edx & (1 << 3)) != 0;
+}
+
 /* Breaks the kernel command line into words and returns them as
    an argv-like array. */
 static char **
@@ -271,6 +310,33 @@ parse_options (char **argv)
 #ifdef USERPROG
       else if (!strcmp (name, "-ul"))
         user_page_limit = atoi (value);
+#endif
+#ifdef VM
+      else if (!strcmp (name, "-ul-low"))
+        vm_frame_low_mark = atoi (value);
+      else if (!strcmp (name, "-ul-high"))
+        vm_frame_high_mark = atoi (value);
+      else if (!strcmp (name, "-evict"))
+        {
+          if (value != NULL && !strcmp (value, "clock"))
+            vm_evict_policy = EVICT_CLOCK;
+          else if (value != NULL && !strcmp (value, "wsclock"))
+            vm_evict_policy = EVICT_WSCLOCK;
+          else if (value != NULL && !strcmp (value, "ws"))
+            vm_evict_policy = EVICT_WS;
+          else
+            PANIC ("unknown eviction policy `%s' (use -h for help)", value);
+        }
+      else if (!strcmp (name, "-vm-report"))
+        vm_report = true;
+      else if (!strcmp (name, "-swap-ra"))
+        vm_swap_readahead = atoi (value);
+      else if (!strcmp (name, "-fault-around"))
+        vm_fault_around = atoi (value);
+      else if (!strcmp (name, "-zswap"))
+        vm_zswap_pool_pages = atoi (value);
+      else if (!strcmp (name, "-mmap-flush"))
+        vm_mfile_flush_ticks = atoi (value);
 #endif
       else
         PANIC ("unknown option `%s' (use -h for help)", name);
@@ -393,6 +459,21 @@ usage (void)
           "  -mlfqs             Use multi-level feedback queue scheduler.\n"
 #ifdef USERPROG
           "  -ul=COUNT          Limit user memory to COUNT pages.\n"
+#endif
+#ifdef VM
+          "  -ul-low=COUNT      Reclaim frames below COUNT free user pages.\n"
+          "  -ul-high=COUNT     Reclaim frames up to COUNT free user pages.\n"
+          "  -evict=POLICY      Use clock (default), wsclock or working set\n"
+          "                     aware (ws) replacement.\n"
+          "  -vm-report         Print paging counters of exiting processes.\n"
+          "  -swap-ra=COUNT     Read up to COUNT (max 16) adjacent pages on a\n"
+          "                     swap fault (default 3, 0 to disable).\n"
+          "  -fault-around=N    Read up to N (max 8) following file pages\n"
+          "                     on a file page fault (default 4).\n"
+          "  -zswap=COUNT       Keep up to COUNT pages of compressed swap\n"
+          "                     in memory (default 32).\n"
+          "  -mmap-flush=TICKS  Write back dirty mmap pages every TICKS\n"
+          "                     timer ticks (default 100, 0 to disable).\n"
 #endif
           );
   shutdown_power_off ();
@@ -9,4 +9,7 @@
 /* Page directory with kernel mappings only. */
 extern uint32_t *init_page_dir;
 
+/* Number of large pages in the kernel virtual mapping. */
+extern size_t init_large_pages;
+
 #endif /* threads/init.h */
@@ -185,6 +185,14 @@ block_size (void *block)
   return d != NULL ? d->block_size : PGSIZE * a->free_cnt - pg_ofs (block);
 }
 
+/* Returns the number of bytes allocated for BLOCK, which must have
+   been allocated with malloc(), calloc(), or realloc(). */
+size_t
+malloc_size (void *block) 
+{
+  return block_size (block);
+}
+
 /* Attempts to resize OLD_BLOCK to NEW_SIZE bytes, possibly
    moving it in the process.
    If successful, returns the new block; on failure, returns a
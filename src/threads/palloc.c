@@ -7,7 +7,9 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include "threads/interrupt.h"
 #include "threads/loader.h"
+#include "threads/pte.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
 
@@ -31,6 +33,7 @@ struct pool
     struct lock lock;                   /* Mutual exclusion. */
     struct bitmap *used_map;            /* Bitmap of free pages. */
     uint8_t *base;                      /* Base of pool. */
+    size_t free_cnt;                    /* Number of free pages. */
   };
 
 /* Two pools: one for kernel data, one for user pages. */
@@ -73,6 +76,7 @@ palloc_get_multiple (enum palloc_flags flags, size_t page_cnt)
   struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
   void *pages;
   size_t page_idx;
+  enum intr_level old_level;
 
   if (page_cnt == 0)
     return NULL;
@@ -82,7 +86,12 @@ palloc_get_multiple (enum palloc_flags flags, size_t page_cnt)
   lock_release (&pool->lock);
 
   if (page_idx != BITMAP_ERROR)
-    pages = pool->base + PGSIZE * page_idx;
+    {
+      pages = pool->base + PGSIZE * page_idx;
+      old_level = intr_disable ();
+      pool->free_cnt -= page_cnt;
+      intr_set_level (old_level);
+    }
   else
     pages = NULL;
 
@@ -100,6 +109,46 @@ palloc_get_multiple (enum palloc_flags flags, size_t page_cnt)
   return pages;
 }
 
+/* Obtains LGPG_CNT contiguous free pages whose physical address
+   is aligned on LGPGSIZE, so that they can be mapped by a single
+   large page, and returns the kernel virtual address of the first
+   one.  Flags are interpreted as in palloc_get_multiple().  Returns
+   a null pointer, unless PAL_ASSERT is set, if the pool has no
+   such run of pages. */
+void *
+palloc_get_large (enum palloc_flags flags)
+{
+  struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
+  uintptr_t base = vtop (pool->base);
+  size_t page_idx = (ROUND_UP (base, LGPGSIZE) - base) / PGSIZE;
+  void *pages = NULL;
+  enum intr_level old_level;
+
+  lock_acquire (&pool->lock);
+  for (; page_idx + LGPG_CNT <= bitmap_size (pool->used_map);
+       page_idx += LGPG_CNT)
+    if (!bitmap_any (pool->used_map, page_idx, LGPG_CNT))
+      {
+        bitmap_set_multiple (pool->used_map, page_idx, LGPG_CNT, true);
+        pages = pool->base + PGSIZE * page_idx;
+        break;
+      }
+  lock_release (&pool->lock);
+
+  if (pages != NULL)
+    {
+      old_level = intr_disable ();
+      pool->free_cnt -= LGPG_CNT;
+      intr_set_level (old_level);
+      if (flags & PAL_ZERO)
+        memset (pages, 0, LGPGSIZE);
+    }
+  else if (flags & PAL_ASSERT)
+    PANIC ("palloc_get_large: out of pages");
+
+  return pages;
+}
+
 /* Obtains a single free page and returns its kernel virtual
    address.
    If PAL_USER is set, the page is obtained from the user pool,
@@ -119,6 +168,7 @@ palloc_free_multiple (void *pages, size_t page_cnt)
 {
   struct pool *pool;
   size_t page_idx;
+  enum intr_level old_level;
 
   ASSERT (pg_ofs (pages) == 0);
   if (pages == NULL || page_cnt == 0)
@@ -139,6 +189,12 @@ palloc_free_multiple (void *pages, size_t page_cnt)
 
   ASSERT (bitmap_all (pool->used_map, page_idx, page_cnt));
   bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+
+  /* May be called with interrupts off, so the counter is protected
+     by disabling interrupts rather than by the pool lock. */
+  old_level = intr_disable ();
+  pool->free_cnt += page_cnt;
+  intr_set_level (old_level);
 }
 
 /* Frees the page at PAGE. */
@@ -148,6 +204,32 @@ palloc_free_page (void *page)
   palloc_free_multiple (page, 1);
 }
 
+/* Returns the number of free pages in the user pool if PAL_USER is
+   set in FLAGS, otherwise in the kernel pool. */
+size_t
+palloc_free_cnt (enum palloc_flags flags)
+{
+  struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
+  return pool->free_cnt;
+}
+
+/* Returns the number of pages in the user pool. */
+size_t
+palloc_user_cnt (void)
+{
+  return bitmap_size (user_pool.used_map);
+}
+
+/* Returns the index of PAGE in the user pool, from 0 up to
+   palloc_user_cnt(), or SIZE_MAX if PAGE is not a user page. */
+size_t
+palloc_user_index (const void *page)
+{
+  if (!page_from_pool (&user_pool, (void *) page))
+    return SIZE_MAX;
+  return pg_no (page) - pg_no (user_pool.base);
+}
+
 /* Initializes pool P as starting at START and ending at END,
    naming it NAME for debugging purposes. */
 static void
@@ -167,6 +249,7 @@ init_pool (struct pool *p, void *base, size_t page_cnt, const char *name)
   lock_init (&p->lock);
   p->used_map = bitmap_create_in_buf (page_cnt, base, bm_pages * PGSIZE);
   p->base = base + bm_pages * PGSIZE;
+  p->free_cnt = page_cnt;
 }
 
 /* Returns true if PAGE was allocated from POOL,
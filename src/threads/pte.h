@@ -66,6 +66,15 @@ static inline uintptr_t pd_no (const void *va) {
 #define PTE_U 0x4               /* 1=user/kernel, 0=kernel only. */
 #define PTE_A 0x20              /* 1=accessed, 0=not acccessed. */
 #define PTE_D 0x40              /* 1=dirty, 0=not dirty (PTEs only). */
+#define PTE_PS 0x80             /* 1=4 MB page, 0=page table (PDEs only). */
+
+/* Large pages.
+   With page size extensions enabled (CR4.PSE) a PDE with PTE_PS
+   set maps a whole 4 MB page, aligned on 4 MB both virtually and
+   physically, without a page table. */
+#define LGPGSIZE PTSPAN                 /* Bytes in a large page. */
+#define LGPG_CNT (LGPGSIZE / PGSIZE)    /* Pages in a large page. */
+#define CR4_PSE 0x10                    /* Page Size Extensions. */
 
 /* Returns a PDE that points to page table PT. */
 static inline uint32_t pde_create (uint32_t *pt) {
@@ -73,10 +82,28 @@ static inline uint32_t pde_create (uint32_t *pt) {
   return vtop (pt) | PTE_U | PTE_P | PTE_W;
 }
 
+/* Returns a PDE that maps the large page starting at PAGE, which
+   must be aligned on LGPGSIZE.
+   If WRITABLE is true then it will be writable as well.
+   If USER is true it will be usable by user code as well. */
+static inline uint32_t pde_create_large (void *page, bool writable,
+                                         bool user) {
+  ASSERT ((vtop (page) & (LGPGSIZE - 1)) == 0);
+  return vtop (page) | PTE_PS | PTE_P | (writable ? PTE_W : 0)
+         | (user ? PTE_U : 0);
+}
+
+/* Returns true if page directory entry PDE maps a large page
+   rather than pointing to a page table. */
+static inline bool pde_is_large (uint32_t pde) {
+  return (pde & (PTE_P | PTE_PS)) == (PTE_P | PTE_PS);
+}
+
 /* Returns a pointer to the page table that page directory entry
    PDE, which must "present", points to. */
 static inline uint32_t *pde_get_pt (uint32_t pde) {
   ASSERT (pde & PTE_P);
+  ASSERT (!(pde & PTE_PS));
   return ptov (pde & PTE_ADDR);
 }
 
@@ -264,6 +264,7 @@ thread_create (const char *name, int priority,
     list_push_back (&thread_current ()->children, &t->child_elem);
   list_init (&t->files);
   list_init (&t->mfiles);
+  list_init (&t->vm_large_pages);
 #endif
 
   return tid;
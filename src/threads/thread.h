@@ -133,6 +133,23 @@ struct thread
     int ret_status;                     /* Return status. */
     bool exited;                        /* If the process exited? */
     bool waited;                        /* If parent thread has called wait */
+
+    /* Owned by vm/frame.c and vm/page.c. */
+    size_t vm_rss;                      /* Resident pages. */
+    size_t vm_ws_size;                  /* Working set size estimate. */
+    size_t vm_ws_count;                 /* Pages seen accessed in the
+                                           clock sweep vm_ws_sweep. */
+    unsigned vm_ws_sweep;
+    unsigned vm_faults;                 /* Page faults handled. */
+    unsigned vm_evictions;              /* Pages evicted. */
+    unsigned vm_minor_faults;           /* Page-ins without disk reads. */
+    unsigned vm_major_faults;           /* Page-ins reading the disk. */
+    unsigned vm_stack_faults;           /* Stack growth page-ins. */
+    unsigned vm_swap_ins;               /* Pages read from swap. */
+    unsigned vm_swap_outs;              /* Pages written to swap. */
+    unsigned vm_file_writes;            /* Pages written back to files. */
+    int64_t vm_load_ticks;              /* Ticks spent loading pages. */
+    struct list vm_large_pages;         /* Resident 4 MB pages. */
 #endif
 
     /* Owned by thread.c. */
@@ -1,6 +1,7 @@
 #include "userprog/exception.h"
 #include <inttypes.h>
 #include <stdio.h>
+#include "devices/timer.h"
 #include "userprog/gdt.h"
 #include "threads/interrupt.h"
 #include "threads/pte.h"
@@ -131,8 +132,8 @@ page_fault (struct intr_frame *f)
   bool write;        /* True: access was write, false: access was read. */
   bool user;         /* True: access by user, false: access by kernel. */
   void *fault_addr;  /* Fault address. */
-  void *fault_page;  /* Fault page. */
   struct vm_page *page; 
+  int64_t start = timer_ticks ();
 
   /* Obtain faulting address, the virtual address that was
      accessed to cause the fault.  It may point to code or to
@@ -159,11 +160,8 @@ page_fault (struct intr_frame *f)
   if ( (user && !is_user_vaddr (fault_addr) ))
     sys_t_exit (-1);
 
-  /* Get the fault page. */
-  fault_page = (void *) (PTE_ADDR & (uint32_t) fault_addr);
-
-  //printf ("\n[page fault] at %p in page %d %d %d %d po=%p\n", fault_addr, fault_page, not_present, write, user, f->esp);
-  page = vm_find_page (fault_page);
+  //printf ("\n[page fault] at %p %d %d %d po=%p\n", fault_addr, not_present, write, user, f->esp);
+  page = vm_find_user_page (fault_addr, f->esp);
 
   /* Try to write on a read-only page. */
   if (page != NULL && write && !page->writable)
@@ -173,17 +171,16 @@ page_fault (struct intr_frame *f)
     {
       //printf ("[Page fault load] rb=%d zb=%d writable=%d page=%d\n", page->file_data.read_bytes, page->file_data.zero_bytes, page->writable, page->addr);
 
-      if ( !vm_load_page (page, false) )
-        sys_t_exit (-1);
-      
-      return;
-    }
-  else if( stack_access (f->esp, fault_addr) )
-    {
-      //printf ("[Need to grow stack]\n");
+      thread_current ()->vm_faults++;
 
-      if ( !vm_grow_stack (fault_page, false) )
+      /* A write to a page sharing its frame copy-on-write gets a
+         private copy of the frame. */
+      if (write && !vm_load_page_for_write (page, false))
         sys_t_exit (-1);
+      if (!write && !vm_load_page (page, false))
+        sys_t_exit (-1);
+      
+      vm_page_count_fault (timer_elapsed (start));
       return;
     }
   else if (user || not_present)
@@ -24,7 +24,8 @@ pagedir_create (void)
 }
 
 /* Destroys page directory PD, freeing all the pages it
-   references. */
+   references.  Large pages are not tracked by the frame table
+   and are freed by their owner. */
 void
 pagedir_destroy (uint32_t *pd) 
 {
@@ -35,7 +36,7 @@ pagedir_destroy (uint32_t *pd)
 
   ASSERT (pd != init_page_dir);
   for (pde = pd; pde < pd + pd_no (PHYS_BASE); pde++)
-    if (*pde & PTE_P) 
+    if ((*pde & PTE_P) && !pde_is_large (*pde))
       {
         uint32_t *pt = pde_get_pt (*pde);
         uint32_t *pte;
@@ -43,13 +44,15 @@ pagedir_destroy (uint32_t *pd)
         for (pte = pt; pte < pt + PGSIZE / sizeof *pte; pte++)
           if (*pte & PTE_P) {
             //printf ("Unload on pagedir clear from preset page...\n");
-            vm_free_frame ( pte_get_page (*pte), pd);
+            vm_free_frame ( pte_get_page (*pte), pd, 
+                            (void *) (((pde - pd) << PDSHIFT) 
+                                      | ((pte - pt) << PTSHIFT)));
           }
           else if(*pte != 0) 
             vm_free_page ((struct vm_page *)*pte);     
-        vm_free_frame (pt, pd);
+        vm_free_frame (pt, pd, NULL);
       }
-  vm_free_frame (pd, pd);
+  vm_free_frame (pd, pd, NULL);
 }
 
 /* Returns the address of the page table entry for virtual
@@ -57,7 +60,8 @@ pagedir_destroy (uint32_t *pd)
    If PD does not have a page table for VADDR, behavior depends
    on CREATE.  If CREATE is true, then a new page table is
    created and a pointer into it is returned.  Otherwise, a null
-   pointer is returned. */
+   pointer is returned.  VADDR mapped by a large page has no page
+   table entry, so a null pointer is returned as well. */
 static uint32_t *
 lookup_page (uint32_t *pd, const void *vaddr, bool create)
 {
@@ -71,6 +75,8 @@ lookup_page (uint32_t *pd, const void *vaddr, bool create)
   /* Check for a page table for VADDR.
      If one is missing, create one if requested. */
   pde = pd + pd_no (vaddr);
+  if (pde_is_large (*pde))
+    return NULL;
   if (*pde == 0) 
     {
       if (create)
@@ -123,6 +129,32 @@ pagedir_set_page (uint32_t *pd, void *upage, void *kpage, bool writable)
     return false;
 }
 
+/* Adds a mapping in page directory PD from the 4 MB of user
+   virtual memory at UPAGE to the large page at KPAGE, both of
+   which must be aligned on LGPGSIZE.  None of the pages in the
+   range may be mapped yet.  KPAGE should be obtained from the
+   user pool with palloc_get_large().
+   If WRITABLE is true, the new page is read/write;
+   otherwise it is read-only.
+   Returns true if successful, false if part of the range already
+   has a page table. */
+bool
+pagedir_set_large_page (uint32_t *pd, void *upage, void *kpage,
+                        bool writable)
+{
+  uint32_t *pde;
+
+  ASSERT (((uintptr_t) upage & (LGPGSIZE - 1)) == 0);
+  ASSERT (is_user_vaddr (upage));
+  ASSERT (pd != init_page_dir);
+
+  pde = pd + pd_no (upage);
+  if (*pde != 0)
+    return false;
+  *pde = pde_create_large (kpage, writable, true);
+  return true;
+}
+
 /* Creates an entry in page directory PD from the user virtual page
    UPAGE to a pointer to the vm_page structure.
    UPAGE must not already be mapped. 
@@ -162,6 +194,10 @@ pagedir_get_page (uint32_t *pd, const void *uaddr)
 
   ASSERT (is_user_vaddr (uaddr));
   
+  if (pde_is_large (pd[pd_no (uaddr)]))
+    return ptov (pd[pd_no (uaddr)] & PTE_ADDR)
+           + ((uintptr_t) uaddr & (LGPGSIZE - 1));
+
   pte = lookup_page (pd, uaddr, false);
   if (pte != NULL && (*pte & PTE_P) != 0)
     return pte_get_page (*pte) + pg_ofs (uaddr);
@@ -188,7 +224,7 @@ pagedir_find_page (uint32_t *pd, const void *uaddr)
       if ((*pte & PTE_P) != 0)
         {
           void *kpage = pte_get_page (*pte) + pg_ofs (uaddr);
-          return vm_frame_get_page (kpage, pd);
+          return vm_frame_get_page (kpage, pd, pg_round_down (uaddr));
         }
       else
         return *pte != 0 ? (void  *)*pte : NULL;
@@ -7,6 +7,8 @@
 uint32_t *pagedir_create (void);
 void pagedir_destroy (uint32_t *pd);
 bool pagedir_set_page (uint32_t *pd, void *upage, void *kpage, bool rw);
+bool pagedir_set_large_page (uint32_t *pd, void *upage, void *kpage,
+                             bool rw);
 bool pagedir_add_page (uint32_t *pf, void *upage, void *vm_page);
 void *pagedir_get_page (uint32_t *pd, const void *upage);
 void *pagedir_find_page (uint32_t *pd, const void *upage);
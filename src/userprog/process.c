@@ -16,11 +16,13 @@
 #include "threads/init.h"
 #include "threads/interrupt.h"
 #include "threads/palloc.h"
+#include "threads/pte.h"
 #include "threads/malloc.h"
 #include "threads/thread.h"
 #include "threads/vaddr.h"
 #include "vm/frame.h"
 #include "vm/page.h"
+#include "vm/mmap.h"
 
 #define MAX_ARGS_SIZE 4096
 
@@ -233,6 +235,11 @@ process_exit (void)
   uint32_t *pd;
     
   printf ("%s: exit(%d)\n", cur->name, cur->ret_status);
+  if (vm_report)
+    {
+      vm_frame_report (cur);
+      vm_page_report (cur);
+    }
 
   if (cur->exec != NULL)
     file_allow_write (cur->exec);
@@ -244,6 +251,8 @@ process_exit (void)
   if (cur->parent != NULL)
     sema_down (&cur->sema_exit); 
 
+  vm_delete_mfiles ();
+
   /* Destroy the current process's page directory and switch back
      to the kernel-only page directory. */
   pd = cur->pagedir;
@@ -259,6 +268,7 @@ process_exit (void)
       cur->pagedir = NULL;
       pagedir_activate (NULL);
       pagedir_destroy (pd);
+      vm_free_large_pages ();
     }
 }
 
@@ -540,12 +550,23 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
       size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
       size_t page_zero_bytes = PGSIZE - page_read_bytes;
 
+      /* Map whole aligned 4 MB runs of zeros with large pages. */
+      if (page_read_bytes == 0 && zero_bytes >= LGPGSIZE
+          && ((uintptr_t) upage & (LGPGSIZE - 1)) == 0
+          && vm_new_large_zero_page (upage, writable))
+        {
+          zero_bytes -= LGPGSIZE;
+          upage += LGPGSIZE;
+          load_ofs += LGPGSIZE;
+          continue;
+        }
+
       //block_sector_t sector_idx = inode_get_inumber (file_get_inode (file), load_ofs);
       off_t block_id = -1;
 
-      /* If we have a read-only segment obtain its corresponding block sector 
-         to be used later on in sharing read-only frames. */
-      if (writable == false)
+      /* Obtain the block sector of the page to be used later on in sharing
+         frames, read-only or copy-on-write for writable segments. */
+      if (writable == false || page_read_bytes > 0)
         block_id = inode_get_block_number (file_get_inode (file), load_ofs);
 
       //printf ("[Load segemnt] rb=%d zb=%d writable=%d page=%d\n", page_read_bytes, page_zero_bytes, writable, upage);
@@ -580,7 +601,7 @@ setup_stack (void **esp)
     return false;
   
   *esp = PHYS_BASE;
-  vm_load_page (page, false);  
+  vm_load_page_for_write (page, false);  
 
   return true;
 }
@@ -1,7 +1,9 @@
 #include "userprog/syscall.h"
 #include "userprog/process.h"
 #include <stdio.h>
+#include <string.h>
 #include <syscall-nr.h>
+#include <vmstat.h>
 #include "devices/shutdown.h"
 #include "devices/input.h"
 #include "threads/interrupt.h"
@@ -42,6 +44,9 @@ static unsigned  sys_tell (int fd);
 static void      sys_close (int fd);
 static mapid_t   sys_mmap (int fd, void *addr);
 static void      sys_munmap (mapid_t mapid);
+static void      sys_msync (mapid_t mapid);
+static bool      sys_madvise (mapid_t mapid, int advice);
+static int       sys_vmstat (struct vmstat *stats);
 
 static struct user_file *file_by_fid (fid_t);
 static fid_t allocate_fid (void);
@@ -83,6 +88,9 @@ syscall_init (void)
   syscall_map[SYS_CLOSE]    = (handler)sys_close;
   syscall_map[SYS_MMAP]     = (handler)sys_mmap;
   syscall_map[SYS_MUNMAP]   = (handler)sys_munmap;
+  syscall_map[SYS_VMSTAT]   = (handler)sys_vmstat;
+  syscall_map[SYS_MSYNC]    = (handler)sys_msync;
+  syscall_map[SYS_MADVISE]  = (handler)sys_madvise;
 
   lock_init (&file_lock);
   list_init (&file_list);
@@ -101,7 +109,8 @@ syscall_handler (struct intr_frame *f)
   if (!( is_user_vaddr (param + 1) && is_user_vaddr (param + 2) && is_user_vaddr (param + 3)))
     sys_exit (-1);
 
-  if (*param < SYS_HALT || *param > SYS_INUMBER)
+  if (*param < SYS_HALT || *param > SYS_MADVISE 
+      || syscall_map[*param] == NULL)
     sys_exit (-1);
 
   function = syscall_map[*param];
@@ -285,21 +294,19 @@ sys_read (int fd, void *buffer, unsigned length)
           ret = 0;
           while (rem > 0)
             {
-              /* Round down the buffer address to a page and try to find a
-                 static page. If we don't find the page we migth have stack
-                 growth. If we find the page we only need to load if is not
-                 present in memory. */
+              /* Find the page of the buffer, which grows the stack if
+                 the buffer lies below it. If we find the page we only
+                 need to load if is not present in memory. */
               size_t ofs = tmp_buffer - pg_round_down (tmp_buffer);
-              struct vm_page *page = vm_find_page (tmp_buffer - ofs);
+              struct vm_page *page = vm_find_user_page (tmp_buffer, esp);
               
-              if (page == NULL && stack_access (esp, tmp_buffer) )
-                page = vm_grow_stack (tmp_buffer - ofs, true);   
-              else if (page == NULL)
+              if (page == NULL)
                 sys_t_exit (-1);
 
-              /* Load the page and pin the frame. */
-              if ( !page->loaded )
-                vm_load_page (page, true);
+              /* Load the page and pin the frame. The kernel doesn't 
+                 fault on read-only mappings, so a page shared 
+                 copy-on-write needs its private copy first. */
+              vm_load_page_for_write (page, true);
 
               size_t read_bytes = ofs + rem > PGSIZE ?
                                   rem - (ofs + rem - PGSIZE) : rem;
@@ -356,16 +363,13 @@ sys_write (int fd, const void *buffer, unsigned length)
             {
               /* See sys_read for a detailed explanation of page loading. */
               size_t ofs = tmp_buffer - pg_round_down (tmp_buffer);
-              struct vm_page *page = vm_find_page (tmp_buffer - ofs);
+              struct vm_page *page = vm_find_user_page (tmp_buffer, esp);
 
-              if (page == NULL && stack_access(esp, tmp_buffer) )
-                page = vm_grow_stack (tmp_buffer - ofs, true);   
-              else if (page == NULL)
+              if (page == NULL)
                 sys_t_exit (-1);
 
               /* Load the page and pin the frame. */
-              if ( !page->loaded )
-                vm_load_page (page, true);
+              vm_load_page (page, true);
 
               size_t write_bytes = ofs + rem > PGSIZE ? 
                                    rem - (ofs + rem - PGSIZE) : rem;
@@ -457,6 +461,9 @@ sys_mmap (int fd, void *addr)
     return -1;
   if (fd == STDIN_FILENO || fd == STDOUT_FILENO)
     return -1;
+  /* The stack region and its guard page are reserved for the stack. */
+  if ((uint8_t *) addr + size > STACK_LIMIT - PGSIZE)
+    return -1;
 
   size_t ofs = 0;
   void *tmp_addr = addr;
@@ -506,9 +513,16 @@ sys_munmap (mapid_t mapid)
     sys_exit (-1);
 
   void *addr = mf->start_addr;
+  void *end_addr = mf->end_addr;
+
+  /* Write the dirty pages back with as few writes as possible, then
+     take the mapping out of the flusher's reach before its pages 
+     are freed. */
+  vm_sync_mfile (mf, true);
+  vm_delete_mfile (mapid);
 
   /* Free each page mapped in memory for the given file. */
-  for (;addr < mf->end_addr; addr += PGSIZE)
+  for (;addr < end_addr; addr += PGSIZE)
     {
       struct vm_page *page = NULL;
 
@@ -521,16 +535,68 @@ sys_munmap (mapid_t mapid)
           vm_pin_page (page);
 
           ASSERT (page->loaded && page->kpage != NULL);
-          vm_free_frame (page->kpage, page->pagedir);
+          vm_free_frame (page->kpage, page->pagedir, page->addr);
           /* We don't really need to unpin the page
           as the holding frame will be deleted when
           we dump the page. */
         } 
       vm_free_page (page);
     }
-  vm_delete_mfile (mapid);
 }
 
+/* Writes the dirty pages of a memory mapped file back to the file. */
+static void
+sys_msync (mapid_t mapid)
+{
+  struct vm_mfile *mf = vm_find_mfile (mapid);
+  if (mf == NULL || mf->pagedir != thread_current ()->pagedir)
+    sys_exit (-1);
+
+  vm_sync_mfile (mf, true);
+}
+
+/* Applies an access hint to a memory mapped file. */
+static bool
+sys_madvise (mapid_t mapid, int advice)
+{
+  struct vm_mfile *mf = vm_find_mfile (mapid);
+  if (mf == NULL || mf->pagedir != thread_current ()->pagedir)
+    sys_exit (-1);
+
+  return vm_advise_mfile (mf, advice);
+}
+
+/* Copies the paging statistics of the current process to STATS. 
+   Like sys_read, the pages written to are loaded and pinned first,
+   as the kernel doesn't fault on read-only mappings. */
+static int
+sys_vmstat (struct vmstat *stats)
+{
+  struct vmstat kstats;
+  uint8_t *dst = (uint8_t *) stats;
+  size_t ofs = 0;
+
+  vm_page_get_stats (thread_current (), &kstats);
+  while (ofs < sizeof kstats)
+    {
+      uint8_t *upage = pg_round_down (dst + ofs);
+      size_t size = upage + PGSIZE - (dst + ofs);
+      struct vm_page *page;
+
+      if (size > sizeof kstats - ofs)
+        size = sizeof kstats - ofs;
+      if (!is_user_vaddr (dst + ofs) 
+          || (page = vm_find_user_page (dst + ofs, param_esp)) == NULL 
+          || !page->writable
+          || !vm_load_page_for_write (page, true))
+        sys_t_exit (-1);
+
+      memcpy (dst + ofs, (uint8_t *) &kstats + ofs, size);
+      vm_frame_unpin (page->kpage);
+      ofs += size;
+    }
+  return 0;
+}
 
 /* Allocate a new fid for a file */
 static fid_t
@@ -1,30 +1,101 @@
 #include "vm/frame.h"
 #include <stdio.h>
+#include <stdint.h>
 #include "userprog/syscall.h"
 #include "userprog/pagedir.h"
 #include "threads/malloc.h"
 #include "threads/synch.h"
+#include "vm/swap.h"
 
 /* Synchronization primitives for the frame table. */
 static struct lock frame_lock;
 static struct lock evict_lock;
-/* Hash table of frames for fast lookup. */
-static struct hash vm_frames;
+/* Frame table, one entry per page of the user pool indexed by 
+   palloc_user_index(). An entry is in use if its addr is not null.
+   Lookups need no lock and frames no memory allocation. */
+static struct vm_frame *vm_frames;
+/* Index of the frames holding shared read-only blocks. */
+static struct hash vm_shared_frames;
+/* Frame of zeroes shared read-only by the untouched zero pages. It
+   is never evicted nor freed, so it isn't on the clock list. */
+static struct vm_frame *zero_frame;
 /* List of frames for the clock eviction algorithm. */
 static struct list vm_frames_list;
 static struct list_elem *e_next;
+static size_t vm_frames_cnt;
 
-/* Frame hash table helper functions. */
-static unsigned frame_hash (const struct hash_elem *, void *);
-static bool frame_less (const struct hash_elem *, 
+/* Number of frames the clock hand looks at to fill a cluster of
+   victims which are written to swap together. */
+#define CLUSTER_SCAN_STEPS (4 * SWAP_CLUSTER_PAGES)
+
+/* Number of frames the WSClock leading hand runs ahead. */
+#define WSCLOCK_HAND_SPREAD 16
+
+/* Page replacement policy, see frame.h. */
+enum vm_evict_policy vm_evict_policy = EVICT_CLOCK;
+bool vm_report;
+
+/* Number of clock sweeps so far. The working set of a process is
+   estimated as the number of its pages the clock hand found
+   accessed during the last complete sweep. */
+static unsigned ws_sweep;
+
+/* WSClock leading hand and the queue of dirty frames it hands to
+   the page cleaner thread. */
+static struct list_elem *e_lead;
+static struct list clean_queue;
+static struct semaphore clean_sema;
+static struct condition clean_cond;
+
+/* Watermarks of the frame reclaimer, see frame.h. */
+size_t vm_frame_low_mark;
+size_t vm_frame_high_mark;
+static struct semaphore reclaim_sema;
+static bool reclaim_pending;
+
+/* Shared frames hash table helper functions. */
+static unsigned share_hash (const struct hash_elem *, void *);
+static bool share_less (const struct hash_elem *,
                         const struct hash_elem *, void *);
 /* Functions for frame lookup and frame delete. */
 static struct vm_frame *find_frame (void *);
-static void delete_frame (struct vm_frame *);
+static bool delete_frame (struct vm_frame *);
+static void unshare_frame (struct vm_frame *);
+static void share_key (struct vm_frame *, struct vm_page *);
+static bool lock_pages (struct vm_frame *);
+
+/* Reverse map of a frame. */
+static void rmap_init (struct vm_frame *);
+static struct vm_page *rmap_get (struct vm_frame *, size_t);
+static void rmap_set (struct vm_frame *, size_t, struct vm_page *);
+static bool rmap_add (struct vm_frame *, struct vm_page *);
+static void rmap_remove (struct vm_frame *, struct vm_page *);
 
 /* Eviction helper function. */
 static bool eviction_scan_and_flip (struct vm_frame *);
+static bool eviction_is_clean (struct vm_frame *);
+static bool eviction_is_accessed (struct vm_frame *);
 static void eviction (void);
+static size_t eviction_pick (void **);
+static struct vm_frame *eviction_clock (void);
+static struct vm_frame *eviction_wsclock (void);
+static struct vm_frame *eviction_ws (void);
+static bool eviction_needs_swap (struct vm_frame *);
+static size_t eviction_cluster (void **);
+static void evict_frames (void **, size_t);
+
+/* Working set estimation. */
+static void ws_sample (struct thread *);
+static size_t ws_size (struct thread *);
+static bool ws_over (struct vm_frame *);
+
+/* WSClock leading hand and page cleaner. */
+static void wsclock_lead_step (void);
+static void frame_cleaner (void *);
+
+/* Background frame reclaimer. */
+static void frame_reclaimer (void *);
+static void reclaim_wake (void);
 
 /* Clock algorithm helper functions. */
 static void eviction_remove_pointer (struct vm_frame *);
@@ -35,77 +106,209 @@ static void eviction_move_next (void);
 void
 vm_frame_init ()
 {
+  void *addr;
+
   lock_init (&frame_lock);
   lock_init (&evict_lock);
-  hash_init (&vm_frames, frame_hash, frame_less, NULL);
+  vm_frames = calloc (palloc_user_cnt (), sizeof *vm_frames);
+  ASSERT (vm_frames != NULL);
+  hash_init (&vm_shared_frames, share_hash, share_less, NULL);
   list_init (&vm_frames_list);
+  list_init (&clean_queue);
+  sema_init (&clean_sema, 0);
+  cond_init (&clean_cond);
+
+  sema_init (&reclaim_sema, 0);
+
+  addr = palloc_get_page (PAL_USER | PAL_ASSERT | PAL_ZERO);
+  zero_frame = &vm_frames[palloc_user_index (addr)];
+  zero_frame->addr = addr;
+  zero_frame->block_id = -1;
+  zero_frame->share_bytes = 0;
+  zero_frame->attach_cnt = 0;
+  zero_frame->pinned = true;
+  zero_frame->cleaning = false;
+  rmap_init (zero_frame);
+  lock_init (&zero_frame->rmap_lock);
+
+  if (vm_evict_policy == EVICT_WSCLOCK)
+    thread_create ("frame_cleaner", PRI_DEFAULT, frame_cleaner, NULL);
+
+  if (vm_frame_low_mark > 0)
+    {
+      if (vm_frame_high_mark < vm_frame_low_mark)
+        vm_frame_high_mark = 2 * vm_frame_low_mark;
+      thread_create ("frame_reclaimer", PRI_DEFAULT, frame_reclaimer, NULL);
+    }
 }
 
-/* Sharing - Looks thourgh all the frames if there is one that contains
-   the required data. This function will be called on each page load of
-   a read only file segment. Because is called quite rare we don't need
-   a fast lookup in a hash table and choosed a list for simplicity. */
+/* Sharing - Looks up a frame that already contains the data of
+   PAGE, a pristine block of a file or a zero page, see 
+   vm_page_share_id. This function will be called on each load of
+   such a page, so the frames holding shared data are indexed by
+   their block id in a separate hash table. PAGE is added to the 
+   reverse map of the frame found, so the caller must not call
+   vm_frame_set_page for it. The frame is pinned and the caller
+   has to unpin it after use. Returns a null pointer if no frame
+   holds the data or PAGE couldn't be added to it. */
 void *
-vm_lookup_frame (off_t block_id)
+vm_lookup_frame (struct vm_page *page)
 {
-  void *addr = NULL;
+  struct vm_frame vf;
+  struct vm_frame *shared = NULL;
+  struct hash_elem *e;
+  bool added;
+
+  share_key (&vf, page);
 
-  struct hash_iterator it;
+  /* Ensure synchronization with other access on the frame's table.
+     The frame counts us as attaching in the same critical section,
+     so it can't be made private nor freed before we are in its
+     reverse map. */
+  lock_acquire (&frame_lock);
+  e = hash_find (&vm_shared_frames, &vf.share_elem);
+  if (e != NULL)
+    {
+      shared = hash_entry (e, struct vm_frame, share_elem);
+      shared->pinned = true;
+      shared->attach_cnt++;
+    }
+  lock_release (&frame_lock);
+  if (shared == NULL)
+    return NULL;
+
+  lock_acquire (&shared->rmap_lock);
+  added = rmap_add (shared, page);
+  lock_release (&shared->rmap_lock);
+
+  lock_acquire (&frame_lock);
+  shared->attach_cnt--;
+  if (!added)
+    shared->pinned = false;
+  lock_release (&frame_lock);
   
-  /* Ensure synchronization with other access on the frame's table. */
+  return added ? shared->addr : NULL;
+}
+
+/* Returns true if a frame already holds the data of PAGE. Unlike 
+   vm_lookup_frame the frame isn't pinned, so the answer is only a
+   hint. */
+bool
+vm_frame_is_shared (struct vm_page *page)
+{
+  struct vm_frame vf;
+  bool shared;
+
+  share_key (&vf, page);
   lock_acquire (&frame_lock);
-  hash_first (&it, &vm_frames);
-  while (hash_next (&it) && addr == NULL)
+  shared = hash_find (&vm_shared_frames, &vf.share_elem) != NULL;
+  lock_release (&frame_lock);
+
+  return shared;
+}
+
+/* Returns the frame of zeroes that read faults on zero pages map
+   copy-on-write instead of allocating and clearing a frame. */
+void *
+vm_zero_frame (void)
+{
+  return zero_frame->addr;
+}
+
+/* Copy-on-write - If the frame at ADDR is mapped by a single page, 
+   removes it from the shared frames index so that page can write 
+   to it and returns true. Returns false if other pages still share
+   the frame or are attaching to it. The check and the removal are
+   done under frame_lock, as vm_lookup_frame counts a new sharer. */
+bool
+vm_frame_make_private (void *addr)
+{
+  struct vm_frame *vf;
+  bool private = true;
+
+  lock_acquire (&evict_lock);
+  vf = find_frame (addr);
+  if (vf == zero_frame)
+    private = false;
+  else if (vf != NULL)
     {
-      struct vm_frame *vf = NULL;
-      vf = hash_entry (hash_cur (&it), struct vm_frame, hash_elem);
+      lock_acquire (&vf->rmap_lock);
+      lock_acquire (&frame_lock);
+      private = vf->rmap_cnt <= 1 && vf->attach_cnt == 0;
+      if (private)
+        unshare_frame (vf);
+      lock_release (&frame_lock);
+      lock_release (&vf->rmap_lock);
+    }
+  lock_release (&evict_lock);
+
+  return private;
+}
 
-      /* Syncronize with the frame page list. */
-      lock_acquire (&vf->list_lock);
-      
-      struct list_elem *e = list_begin (&vf->pages);
-      struct vm_page *page = list_entry (e, struct vm_page, frame_elem);
+/* Copy-on-write - Removes PAGE, which has moved to a frame of its
+   own, from the pages of the frame at ADDR without unloading it.
+   Frees the frame if no other page uses it, otherwise unpins it. */
+void
+vm_frame_remove_page (void *addr, struct vm_page *page)
+{
+  struct vm_frame *vf;
 
-      /* Takes a page to see if the frame contains the same data block. */
-      if (page->type == FILE && page->file_data.block_id == block_id)
-        {
-          addr = vf->addr;
-          vf->pinned = true;
-        }
+  lock_acquire (&evict_lock);
+  vf = find_frame (addr);
+  if (vf != NULL)
+    {
+      while (vf->cleaning)
+        cond_wait (&clean_cond, &evict_lock);
 
-      lock_release (&vf->list_lock);
+      lock_acquire (&vf->rmap_lock);
+      rmap_remove (vf, page);
+      lock_release (&vf->rmap_lock);
+
+      if (vf == zero_frame)
+        ;
+      else if (delete_frame (vf))
+        palloc_free_page (addr);
+      else
+        vf->pinned = false;
     }
-  lock_release (&frame_lock);
-  
-  return addr;
+  lock_release (&evict_lock);
 }
 
 /* Obtains a free frame. Evicts a frame if memory allocation fails. */
 void *
 vm_get_frame (enum palloc_flags flags)
 {
-  void *addr = palloc_get_page (flags);
+  void *addr;
+
+  ASSERT (flags & PAL_USER);
+
+  addr = palloc_get_page (flags);
   
   /* If memory allocation was successful. */
   if (addr != NULL) 
   {
-    struct vm_frame *vf;
-    vf = (struct vm_frame *) malloc (sizeof (struct vm_frame) );
-
-    if (vf == NULL)
-      return false;
+    struct vm_frame *vf = &vm_frames[palloc_user_index (addr)];
 
+    ASSERT (vf->addr == NULL);
     vf->addr = addr;
+    vf->block_id = -1;
+    vf->share_bytes = 0;
+    vf->attach_cnt = 0;
     /* A new frame will be pinned until the caller will load the data to it.
        This way pe make sure it won't be evicted anytime in between. */
     vf->pinned = true;
-    list_init (&vf->pages);
-    lock_init (&vf->list_lock);
+    vf->cleaning = false;
+    rmap_init (vf);
+    lock_init (&vf->rmap_lock);
 
     lock_acquire (&frame_lock);
 		list_push_back (&vm_frames_list, &vf->list_elem);
-    hash_insert (&vm_frames, &vf->hash_elem);   
+    vm_frames_cnt++;
     lock_release (&frame_lock);
+
+    /* Start reclaiming frames before we run out of memory. */
+    if (palloc_free_cnt (flags) < vm_frame_low_mark)
+      reclaim_wake ();
   }
   else
   {
@@ -115,6 +318,7 @@ vm_get_frame (enum palloc_flags flags)
 #endif
 
     /* Evict a frame and try again. */
+    reclaim_wake ();
     eviction ();
     return vm_get_frame (flags);
   }
@@ -123,56 +327,96 @@ vm_get_frame (enum palloc_flags flags)
 }
 
 /* Frees the given frame and writes the data back to swap
-   or file. This function will be called on process exit. */
+   or file. This function will be called on process exit. If 
+   PAGEDIR is not null only the page mapped at UPAGE of PAGEDIR,
+   or the first page of PAGEDIR if UPAGE is null, is unloaded.
+   Otherwise the frame is evicted, unless one of its pages is busy
+   being loaded or cleaned, in which case the frame is just unpinned
+   and the caller has to pick another one. */
 void 
-vm_free_frame (void *addr, uint32_t *pagedir)
+vm_free_frame (void *addr, uint32_t *pagedir, void *upage)
 {
+  struct vm_page *page = NULL;
+  struct vm_frame *vf;
+
+  /* We never wait for a page's lock while holding the frame table
+     locks, so the lock of the single page is taken first. If the 
+     page left the frame meanwhile there is nothing left to free. */
+  if (pagedir != NULL)
+    {
+      page = vm_frame_get_page (addr, pagedir, upage);
+      if (page != NULL)
+        {
+          lock_acquire (&page->lock);
+          if (!page->loaded || page->kpage != addr)
+            {
+              lock_release (&page->lock);
+              return;
+            }
+        }
+    }
+
   lock_acquire (&evict_lock);
-  struct vm_frame *vf = find_frame (addr);  
-  struct list_elem *e;
+  vf = find_frame (addr);  
   
   if (vf == NULL) 
     {
       lock_release (&evict_lock);
+      if (page != NULL)
+        lock_release (&page->lock);
       return; 
     }
 
+  /* Wait for the page cleaner to finish writing the frame out. */
+  while (vf->cleaning)
+    cond_wait (&clean_cond, &evict_lock);
+
   if (pagedir == NULL)
     {
       /* Unloads and removes from the list all the pages that share 
-         this frame. This will be called when we evict a frame. */
-      lock_acquire (&vf->list_lock);
-      while (!list_empty (&vf->pages) )
+         this frame. This will be called when we evict a frame, so
+         no other process may start sharing it in meantime. We never
+         wait for a page's lock while holding the frame table locks,
+         its holder may be waiting for them. */
+      lock_acquire (&vf->rmap_lock);
+      if (!lock_pages (vf))
         {
-          e = list_begin (&vf->pages);
-          struct vm_page *page = list_entry (e, struct vm_page, frame_elem);
-          list_remove (&page->frame_elem);
+          lock_release (&vf->rmap_lock);
+          vf->pinned = false;
+          lock_release (&evict_lock);
+          return;
+        }
+      lock_acquire (&frame_lock);
+      unshare_frame (vf);
+      lock_release (&frame_lock);
+      while (vf->rmap_cnt > 0)
+        {
+          struct vm_page *page = rmap_get (vf, vf->rmap_cnt - 1);
+          rmap_remove (vf, page);
+          page->owner->vm_evictions++;
           vm_unload_page (page, vf->addr);
+          lock_release (&page->lock);
         }
-      lock_release (&vf->list_lock);
+      lock_release (&vf->rmap_lock);
     }
   else
     {
       /* Frees only one page and the frame remains if it contains other
          pages. Will be used this way on process_exit or file unmap. */
-      struct vm_page *page = vm_frame_get_page (addr, pagedir);
-      
       if (page != NULL)
         {
-          lock_acquire (&vf->list_lock);
-          list_remove (&page->frame_elem);
-          lock_release (&vf->list_lock);
+          lock_acquire (&vf->rmap_lock);
+          rmap_remove (vf, page);
+          lock_release (&vf->rmap_lock);
           vm_unload_page (page, vf->addr);
+          lock_release (&page->lock);
         }
     }
 
   /* If the frames doen't contain any more pages we can free
      the frame struct. */
-  if (list_empty (&vf->pages))
-  {
-    delete_frame (vf);
+  if (vf != zero_frame && delete_frame (vf))
     palloc_free_page (addr);
-  }
   lock_release (&evict_lock);
 }
 
@@ -181,74 +425,220 @@ bool
 vm_frame_set_page (void *frame, struct vm_page *page)
 {
   struct vm_frame *vf = find_frame (frame);
+  bool first;
   
   if (vf == NULL)
     return false;
 
-  lock_acquire (&vf->list_lock);
-  list_push_back (&vf->pages, &page->frame_elem);
-  lock_release (&vf->list_lock);
+  lock_acquire (&vf->rmap_lock);
+  if (!rmap_add (vf, page))
+    {
+      lock_release (&vf->rmap_lock);
+      return false;
+    }
+  first = vf->rmap_cnt == 1;
+  lock_release (&vf->rmap_lock);
+
+  /* The first page of a pristine file block or zero page publishes
+     the frame so that other processes can share it. Pages sharing
+     a published frame are added by vm_lookup_frame, so a frame 
+     made private is never published again. */
+  if (first && vm_page_share_id (page) != -1 && vf->block_id == -1)
+    {
+      lock_acquire (&frame_lock);
+      share_key (vf, page);
+      if (hash_insert (&vm_shared_frames, &vf->share_elem) != NULL)
+        vf->block_id = -1;
+      lock_release (&frame_lock);
+    }
   return true;
 }
 
 /* Obtains a reference to a page struct from a frame page list.
-   A page is uniquely indentified by its pagedir and kernel 
-   page. Since a frame can be shared between multiple pages we
-   need to make a unique choice. */
+   A page is uniquely indentified by its pagedir, user address
+   and kernel page. Since a frame can be shared between multiple 
+   pages, several of the same process in the case of the zero 
+   frame, we need to make a unique choice. If UPAGE is null the 
+   first page of PAGEDIR is returned. */
 struct vm_page*
-vm_frame_get_page (void *frame, uint32_t *pagedir)
+vm_frame_get_page (void *frame, uint32_t *pagedir, void *upage)
 {
   struct vm_frame *vf = find_frame (frame);
-  struct list_elem *e;
+  size_t i;
 
   if (vf == NULL)
     return NULL;
 
-  lock_acquire (&vf->list_lock);
-  for (e = list_begin (&vf->pages); e != list_end (&vf->pages);
-       e = list_next (e))
+  lock_acquire (&vf->rmap_lock);
+  for (i = 0; i < vf->rmap_cnt; i++)
     {
-      struct vm_page *page = list_entry (e, struct vm_page, frame_elem);
-      if (page->pagedir == pagedir)
+      struct vm_page *page = rmap_get (vf, i);
+      if (page->pagedir == pagedir && (upage == NULL || page->addr == upage))
         {
-          lock_release (&vf->list_lock);
+          lock_release (&vf->rmap_lock);
           return page;
         }
     }
-  lock_release (&vf->list_lock);
+  lock_release (&vf->rmap_lock);
   
   return NULL; 
 }
 
-/* Removes the given page from its frame. Sets the clock eviction
-   pointer to the next frame. Reclaims memory of the frame struct. */
+/* Acquires the locks of all the pages of frame VF without waiting.
+   If one of them is held, releases the ones acquired and returns
+   false. The caller must hold the frame's rmap_lock. */
+static bool
+lock_pages (struct vm_frame *vf)
+{
+  size_t i, j;
+
+  for (i = 0; i < vf->rmap_cnt; i++)
+    {
+      struct vm_page *page = rmap_get (vf, i);
+      if (!lock_try_acquire (&page->lock))
+        {
+          for (j = 0; j < i; j++)
+            lock_release (&rmap_get (vf, j)->lock);
+          return false;
+        }
+    }
+  return true;
+}
+
+/* Initializes the empty reverse map of frame VF. */
+static void
+rmap_init (struct vm_frame *vf)
+{
+  vf->rmap_more = NULL;
+  vf->rmap_cap = 0;
+  vf->rmap_cnt = 0;
+}
+
+/* Returns the page at index I of the reverse map of frame VF. */
+static struct vm_page *
+rmap_get (struct vm_frame *vf, size_t i)
+{
+  ASSERT (i < vf->rmap_cnt);
+  return i < RMAP_INLINE ? vf->rmap[i] : vf->rmap_more[i - RMAP_INLINE];
+}
+
+/* Stores PAGE at index I of the reverse map of frame VF. The page
+   remembers its index, so it can be removed without a search. */
+static void
+rmap_set (struct vm_frame *vf, size_t i, struct vm_page *page)
+{
+  if (i < RMAP_INLINE)
+    vf->rmap[i] = page;
+  else
+    vf->rmap_more[i - RMAP_INLINE] = page;
+  page->rmap_idx = i;
+}
+
+/* Adds PAGE to the reverse map of frame VF. Returns false if out
+   of memory. The caller must hold the frame's rmap_lock. */
+static bool
+rmap_add (struct vm_frame *vf, struct vm_page *page)
+{
+  if (vf->rmap_cnt == RMAP_INLINE + vf->rmap_cap)
+    {
+      size_t cap = vf->rmap_cap > 0 ? 2 * vf->rmap_cap : RMAP_INLINE;
+      struct vm_page **more = realloc (vf->rmap_more, cap * sizeof *more);
+
+      if (more == NULL)
+        return false;
+      vf->rmap_more = more;
+      vf->rmap_cap = cap;
+    }
+  rmap_set (vf, vf->rmap_cnt, page);
+  vf->rmap_cnt++;
+  return true;
+}
+
+/* Removes PAGE from the reverse map of frame VF by moving the last
+   page into its slot. The overflow array is freed once the pages
+   fit inline again. The caller must hold the frame's rmap_lock. */
 static void
+rmap_remove (struct vm_frame *vf, struct vm_page *page)
+{
+  size_t i = page->rmap_idx;
+  struct vm_page *last;
+
+  ASSERT (rmap_get (vf, i) == page);
+  last = rmap_get (vf, vf->rmap_cnt - 1);
+  vf->rmap_cnt--;
+  if (i < vf->rmap_cnt)
+    rmap_set (vf, i, last);
+
+  if (vf->rmap_more != NULL && vf->rmap_cnt <= RMAP_INLINE)
+    {
+      free (vf->rmap_more);
+      vf->rmap_more = NULL;
+      vf->rmap_cap = 0;
+    }
+}
+
+/* Removes the given frame if no page maps it and no page is
+   attaching to it. Sets the clock eviction pointer to the next 
+   frame. Marks the frame table entry free. Returns true if the
+   frame was removed, the caller then frees its page. */
+static bool
 delete_frame (struct vm_frame *vf)
 {
   lock_acquire (&frame_lock);
+  if (vf->rmap_cnt > 0 || vf->attach_cnt > 0)
+    {
+      lock_release (&frame_lock);
+      return false;
+    }
 	eviction_remove_pointer (vf);
-  hash_delete (&vm_frames, &vf->hash_elem);
+  unshare_frame (vf);
 	list_remove (&vf->list_elem);
-	free (vf);
+  vm_frames_cnt--;
+  vf->addr = NULL;
   lock_release (&frame_lock);
+  return true;
+}
+
+/* Removes the given frame from the shared frames index so it won't
+   be returned by future lookups. The caller must hold frame_lock. */
+static void
+unshare_frame (struct vm_frame *vf)
+{
+  if (vf->block_id == -1)
+    return;
+  hash_delete (&vm_shared_frames, &vf->share_elem);
+  vf->block_id = -1;
+}
+
+/* Sets the shared frames index key of frame VF to the data of
+   PAGE. A block is only shared between pages which read the same
+   number of bytes of it, as the rest of the frame is zeroed. */
+static void
+share_key (struct vm_frame *vf, struct vm_page *page)
+{
+  vf->block_id = vm_page_share_id (page);
+  vf->share_bytes = page->type == FILE ? page->file_data.read_bytes : 0;
 }
 
 /* Iterates over all the pages which are sharing the given frame.
    Looks at the accesed bit of each page. If all of them are 0 
    then we have found a victim frame, otherwise flip the first 1
-   bit and continue. Synchronization must be done by the caller.*/
+   bit and continue. The caller must hold the frame's rmap_lock.
+   The scanners hold frame_lock, which is taken after rmap_lock
+   elsewhere, so they only try the lock and skip a frame whose
+   reverse map is busy. */
 static bool
 eviction_scan_and_flip (struct vm_frame *vf)
 {
-  struct list_elem *e;
+  size_t i;
   
-  for (e = list_begin (&vf->pages); e != list_end (&vf->pages);
-       e = list_next (e))
+  for (i = 0; i < vf->rmap_cnt; i++)
     {
-      struct vm_page *page = list_entry (e, struct vm_page, frame_elem);
+      struct vm_page *page = rmap_get (vf, i);
       if (pagedir_is_accessed (page->pagedir, page->addr) )
         {
           pagedir_set_accessed (page->pagedir, page->addr, false);
+          ws_sample (page->owner);
           return false;
         }
     }
@@ -256,27 +646,226 @@ eviction_scan_and_flip (struct vm_frame *vf)
   return true;
 }
 
+/* Returns true if none of the pages sharing the given frame needs
+   to be written out before the frame can be reused. The caller 
+   must hold the frame's rmap_lock. */
+static bool
+eviction_is_clean (struct vm_frame *vf)
+{
+  size_t i;
+
+  for (i = 0; i < vf->rmap_cnt; i++)
+    {
+      struct vm_page *page = rmap_get (vf, i);
+      if (!vm_page_is_clean (page))
+        return false;
+    }
+
+  return true;
+}
+
+/* Returns true if one of the pages sharing the given frame has its
+   accessed bit set, without clearing it. The caller must hold the
+   frame's rmap_lock. */
+static bool
+eviction_is_accessed (struct vm_frame *vf)
+{
+  size_t i;
+
+  for (i = 0; i < vf->rmap_cnt; i++)
+    {
+      struct vm_page *page = rmap_get (vf, i);
+      if (pagedir_is_accessed (page->pagedir, page->addr))
+        return true;
+    }
+
+  return false;
+}
+
+/* Evicts a frame chosen by the current replacement policy. If all
+   the frames are pinned or being cleaned we let the other threads
+   run and try again. */
+static void
+eviction ()
+{
+  void *victims[SWAP_CLUSTER_PAGES];
+  size_t cnt;
+
+  while ((cnt = eviction_pick (victims)) == 0)
+    thread_yield ();
+  evict_frames (victims, cnt);
+}
+
+/* Picks a victim frame using the policy selected by vm_evict_policy
+   and stores its address in VICTIMS. If the victim has to be written
+   to swap, more victims that would be written to swap as well are
+   added after it, so they can share a single disk write. Returns the
+   number of victims, 0 if there is none to evict. The victims are 
+   pinned before the frame table locks are released, so no other 
+   thread will choose them as well. */
+static size_t
+eviction_pick (void **victims)
+{
+  struct vm_frame *victim = NULL;
+  size_t cnt = 0;
+
+  lock_acquire (&evict_lock);
+  lock_acquire (&frame_lock);
+
+  if (vm_evict_policy == EVICT_WSCLOCK)
+    victim = eviction_wsclock ();
+  else if (vm_evict_policy == EVICT_WS)
+    victim = eviction_ws ();
+  else
+    victim = eviction_clock ();
+  if (victim != NULL)
+    {
+      bool needs_swap = false;
+
+      victim->pinned = true;
+      victims[cnt++] = victim->addr;
+      if (lock_try_acquire (&victim->rmap_lock))
+        {
+          needs_swap = eviction_needs_swap (victim);
+          lock_release (&victim->rmap_lock);
+        }
+      if (needs_swap)
+        cnt += eviction_cluster (victims + cnt);
+    }
+
+  lock_release (&frame_lock);
+  lock_release (&evict_lock);
+  return cnt;
+}
+
+/* Returns true if the frame holds a single page which has to be 
+   written to swap on eviction. The caller must hold the frame's
+   rmap_lock. */
+static bool
+eviction_needs_swap (struct vm_frame *vf)
+{
+  return vf->rmap_cnt == 1 && vm_page_needs_swap (rmap_get (vf, 0));
+}
+
+/* Moves the clock hand past the current victim and looks at up to
+   CLUSTER_SCAN_STEPS frames for more victims which have to be 
+   written to swap. Stores the address of each one in VICTIMS, at 
+   most SWAP_CLUSTER_PAGES - 1 of them, pins them and returns their
+   number. The caller must hold evict_lock and frame_lock. */
+static size_t
+eviction_cluster (void **victims)
+{
+  size_t cnt = 0;
+  size_t step;
+
+  for (step = 0; step < CLUSTER_SCAN_STEPS && step < vm_frames_cnt
+         && cnt < SWAP_CLUSTER_PAGES - 1; step++)
+    {
+      struct vm_frame *vf;
+      bool victim;
+
+      eviction_move_next ();
+      vf = eviction_get_next ();
+      if (vf == NULL)
+        break;
+      if (vf->pinned || vf->cleaning || !lock_try_acquire (&vf->rmap_lock))
+        continue;
+      victim = eviction_needs_swap (vf) && eviction_scan_and_flip (vf);
+      lock_release (&vf->rmap_lock);
+      if (!victim)
+        continue;
+
+      vf->pinned = true;
+      victims[cnt++] = vf->addr;
+    }
+
+  return cnt;
+}
+
+/* Evicts the CNT frames at the addresses in VICTIMS. The pages of
+   the ones which still hold a single page to be written to swap are
+   unloaded together, with one write to consecutive swap slots. The
+   others are evicted one by one. */
+static void
+evict_frames (void **victims, size_t cnt)
+{
+  struct vm_page *pages[SWAP_CLUSTER_PAGES];
+  void *kpages[SWAP_CLUSTER_PAGES];
+  struct vm_frame *frames[SWAP_CLUSTER_PAGES];
+  size_t i, n = 0;
+
+  if (cnt > 1)
+    {
+      lock_acquire (&evict_lock);
+      for (i = 0; i < cnt; i++)
+        {
+          struct vm_frame *vf = find_frame (victims[i]);
+
+          if (vf == NULL || vf->cleaning)
+            continue;
+          lock_acquire (&vf->rmap_lock);
+          if (eviction_needs_swap (vf) && lock_pages (vf))
+            {
+              pages[n] = rmap_get (vf, 0);
+              rmap_remove (vf, pages[n]);
+              pages[n]->owner->vm_evictions++;
+              kpages[n] = vf->addr;
+              frames[n++] = vf;
+              victims[i] = NULL;
+            }
+          lock_release (&vf->rmap_lock);
+        }
+
+      if (n > 0)
+        {
+          vm_unload_swap_cluster (pages, kpages, n);
+          for (i = 0; i < n; i++)
+            {
+              lock_release (&pages[i]->lock);
+              if (delete_frame (frames[i]))
+                palloc_free_page (kpages[i]);
+            }
+        }
+      lock_release (&evict_lock);
+    }
+
+  for (i = 0; i < cnt; i++)
+    if (victims[i] != NULL)
+      vm_free_frame (victims[i], NULL, NULL);
+}
+
 /* The Clock page replacement algorithm. We keep a circular list
    where a hand points to the oldest page. When a page fault occurs
    we look at the accessed bit. If it's 1 we set it to 0 and move on.
    This approach has better performance than the second chance 
    algorithm. For further reference and a more complete explication 
-   see MODERN OPERATING SYSTEMS, [Andrew S. Tanenbaum] page 111. */
-static void
-eviction ()
+   see MODERN OPERATING SYSTEMS, [Andrew S. Tanenbaum] page 111.
+   Returns a null pointer if all the frames are pinned. */
+static struct vm_frame *
+eviction_clock (void)
 {
   struct vm_frame *victim = NULL;
+  size_t step;
 
-  lock_acquire (&evict_lock);
-	lock_acquire (&frame_lock);
-
-  while (victim == NULL)
+  /* Give up after two sweeps, the caller will try again. */
+  for (step = 0; step < 2 * vm_frames_cnt && victim == NULL; step++)
     {
 			struct vm_frame *vf = eviction_get_next ();
-      ASSERT (vf != NULL);
+      bool accessed;
+
+      if (vf == NULL)
+        break;
 
       /* If the frame is pinned or accessed move on. */
-      if (vf->pinned == true || eviction_scan_and_flip(vf) == false)
+      if (vf->pinned == true || vf->cleaning 
+          || !lock_try_acquire (&vf->rmap_lock))
+        {
+          eviction_move_next ();
+      	  continue;  
+        }    
+      accessed = !eviction_scan_and_flip (vf);
+      lock_release (&vf->rmap_lock);
+      if (accessed)
         {
           eviction_move_next ();
       	  continue;  
@@ -285,9 +874,245 @@ eviction ()
       victim = vf;
     }
 
-	lock_release (&frame_lock);
-  lock_release (&evict_lock);
-  vm_free_frame (victim->addr, NULL);
+  return victim;
+}
+
+/* The WSClock page replacement algorithm. A leading hand runs
+   WSCLOCK_HAND_SPREAD frames ahead of the clock hand, clearing the
+   accessed bits and queueing the dirty frames that were not used
+   since its last sweep for the page cleaner thread. The trailing
+   hand only reclaims frames which are neither accessed nor dirty, so
+   a page fault doesn't have to wait for a disk write. If two whole
+   sweeps don't find a clean frame we fall back to the plain clock
+   and write the victim synchronously. See MODERN OPERATING SYSTEMS,
+   [Andrew S. Tanenbaum] page 216. */
+static struct vm_frame *
+eviction_wsclock (void)
+{
+  size_t step;
+
+  for (step = 0; step < 2 * vm_frames_cnt; step++)
+    {
+      struct vm_frame *vf;
+
+      wsclock_lead_step ();
+      vf = eviction_get_next ();
+      if (vf == NULL)
+        break;
+      if (!vf->pinned && !vf->cleaning && lock_try_acquire (&vf->rmap_lock))
+        {
+          /* The leading hand clears accessed bits, the trailing
+             hand only looks at them. */
+          bool victim = eviction_is_clean (vf) && !eviction_is_accessed (vf);
+
+          lock_release (&vf->rmap_lock);
+          if (victim)
+            return vf;
+        }
+      eviction_move_next ();
+    }
+
+  return eviction_clock ();
+}
+
+/* Working set aware clock. Gives frames a second chance as the 
+   plain clock does, but in a first sweep only takes frames whose
+   pages all belong to processes with more resident pages than
+   their working set estimate, so a thrashing process doesn't push
+   out the working sets of the others. If there is none we fall 
+   back to the plain clock. */
+static struct vm_frame *
+eviction_ws (void)
+{
+  size_t step;
+
+  for (step = 0; step < vm_frames_cnt; step++)
+    {
+      struct vm_frame *vf = eviction_get_next ();
+
+      if (vf == NULL)
+        break;
+      if (!vf->pinned && !vf->cleaning && lock_try_acquire (&vf->rmap_lock))
+        {
+          bool victim = ws_over (vf) && eviction_scan_and_flip (vf);
+
+          lock_release (&vf->rmap_lock);
+          if (victim)
+            return vf;
+        }
+      eviction_move_next ();
+    }
+
+  return eviction_clock ();
+}
+
+/* Counts a page of process T found accessed by the clock hand. The
+   count of the previous sweep becomes T's working set estimate. */
+static void
+ws_sample (struct thread *t)
+{
+  ws_size (t);
+  t->vm_ws_count++;
+}
+
+/* Returns the working set estimate of process T, starting a new
+   count if the clock hand started a new sweep since T's last 
+   sample. A process with no sample in the last sweep had no page
+   accessed. */
+static size_t
+ws_size (struct thread *t)
+{
+  if (t->vm_ws_sweep != ws_sweep)
+    {
+      t->vm_ws_size = t->vm_ws_sweep + 1 == ws_sweep ? t->vm_ws_count : 0;
+      t->vm_ws_count = 0;
+      t->vm_ws_sweep = ws_sweep;
+    }
+  return t->vm_ws_size;
+}
+
+/* Returns true if all the pages of frame VF belong to processes with
+   more resident pages than their working set estimate. The caller 
+   must hold the frame's rmap_lock. */
+static bool
+ws_over (struct vm_frame *vf)
+{
+  size_t i;
+
+  if (vf->rmap_cnt == 0)
+    return false;
+  for (i = 0; i < vf->rmap_cnt; i++)
+    {
+      struct vm_page *page = rmap_get (vf, i);
+      if (page->owner->vm_rss <= ws_size (page->owner))
+        return false;
+    }
+  return true;
+}
+
+/* Prints the resident set size, working set estimate, page faults
+   and evicted pages of process T. */
+void
+vm_frame_report (struct thread *t)
+{
+  printf ("%s: rss %zu, working set %zu, faults %u, evictions %u\n",
+          t->name, t->vm_rss, ws_size (t), t->vm_faults, t->vm_evictions);
+}
+
+/* Moves the WSClock leading hand one frame forward. A frame that
+   hasn't been accessed since the previous sweep but would need a
+   write on eviction is queued for the page cleaner. The caller
+   must hold frame_lock. */
+static void
+wsclock_lead_step (void)
+{
+  struct vm_frame *vf;
+
+  if (list_empty (&vm_frames_list))
+    {
+      e_lead = NULL;
+      return;
+    }
+  if (e_lead == NULL || e_lead == list_end (&vm_frames_list))
+    {
+      /* Start the leading hand ahead of the clock hand. */
+      size_t i;
+
+      eviction_get_next ();
+      e_lead = e_next;
+      for (i = 0; i < WSCLOCK_HAND_SPREAD; i++)
+        {
+          e_lead = list_next (e_lead);
+          if (e_lead == list_end (&vm_frames_list))
+            e_lead = list_begin (&vm_frames_list);
+        }
+    }
+
+  vf = list_entry (e_lead, struct vm_frame, list_elem);
+  if (!vf->pinned && !vf->cleaning && lock_try_acquire (&vf->rmap_lock))
+    {
+      bool dirty = eviction_scan_and_flip (vf) && !eviction_is_clean (vf);
+
+      lock_release (&vf->rmap_lock);
+      if (dirty)
+        {
+          vf->cleaning = true;
+          list_push_back (&clean_queue, &vf->clean_elem);
+          sema_up (&clean_sema);
+        }
+    }
+
+  e_lead = list_next (e_lead);
+}
+
+/* Page cleaner thread. Writes the frames queued by the WSClock
+   leading hand back to swap or file while they stay mapped. A frame
+   being cleaned is skipped by eviction and vm_free_frame waits for
+   it, so it can be used without holding the frame table locks 
+   during the disk write. */
+static void
+frame_cleaner (void *aux UNUSED)
+{
+  for (;;)
+    {
+      struct vm_frame *vf;
+      size_t i;
+
+      sema_down (&clean_sema);
+      lock_acquire (&frame_lock);
+      if (list_empty (&clean_queue))
+        {
+          lock_release (&frame_lock);
+          continue;
+        }
+      vf = list_entry (list_pop_front (&clean_queue), struct vm_frame,
+                       clean_elem);
+      lock_release (&frame_lock);
+
+      lock_acquire (&vf->rmap_lock);
+      for (i = 0; i < vf->rmap_cnt; i++)
+        vm_clean_page (rmap_get (vf, i), vf->addr);
+      lock_release (&vf->rmap_lock);
+
+      lock_acquire (&evict_lock);
+      vf->cleaning = false;
+      cond_broadcast (&clean_cond, &evict_lock);
+      lock_release (&evict_lock);
+    }
+}
+
+/* Wakes up the frame reclaimer if it is enabled and not already
+   running. */
+static void
+reclaim_wake (void)
+{
+  if (vm_frame_low_mark == 0 || reclaim_pending)
+    return;
+  reclaim_pending = true;
+  sema_up (&reclaim_sema);
+}
+
+/* Frame reclaimer thread. Once the free user pool pages drop below
+   vm_frame_low_mark it evicts frames until there are at least
+   vm_frame_high_mark free pages again, so most allocations get a
+   free page straight from palloc. With WSClock the sweeps also
+   queue dirty frames for the page cleaner. */
+static void
+frame_reclaimer (void *aux UNUSED)
+{
+  for (;;)
+    {
+      sema_down (&reclaim_sema);
+      while (palloc_free_cnt (PAL_USER) < vm_frame_high_mark)
+        {
+          void *victims[SWAP_CLUSTER_PAGES];
+          size_t cnt = eviction_pick (victims);
+          if (cnt == 0)
+            break;
+          evict_frames (victims, cnt);
+        }
+      reclaim_pending = false;
+    }
 }
 
 /* Pinns the frame at the given address. A pinned frame can;t be evicted. */
@@ -299,55 +1124,59 @@ vm_frame_pin (void *addr)
     vf->pinned = true;
 }
 
-/* Unpinns the frame at the given address. */
+/* Unpinns the frame at the given address. The zero frame stays
+   pinned. */
 void
 vm_frame_unpin (void *addr)
 {
   struct vm_frame *vf = find_frame (addr);
-  if (vf != NULL)
+  if (vf != NULL && vf != zero_frame)
     vf->pinned = false;
 }
 
 /* Returns the frame containing the given page, or a null pointer in not 
-   found. */
+   found. Kernel pages, page tables for instance, have no frame. */
 static struct vm_frame *
 find_frame (void *addr)
 {
-  struct vm_frame vf;
-  struct hash_elem *e;
+  size_t idx = palloc_user_index (addr);
 
-  vf.addr = addr;
-  lock_acquire (&frame_lock);
-  e = hash_find (&vm_frames, &vf.hash_elem);
-  lock_release (&frame_lock);
-  return e != NULL ? hash_entry (e, struct vm_frame, hash_elem) : NULL;
+  if (idx == SIZE_MAX || vm_frames[idx].addr != addr)
+    return NULL;
+  return &vm_frames[idx];
 }
 
-/* Returns a hash value for a frame f. */
+/* Returns a hash value for the shared block of frame f. */
 static unsigned
-frame_hash (const struct hash_elem *f_, void *aux UNUSED)
+share_hash (const struct hash_elem *f_, void *aux UNUSED)
 {
-  const struct vm_frame *f = hash_entry (f_, struct vm_frame, hash_elem);
-  return hash_int ((unsigned)f->addr);
+  const struct vm_frame *f = hash_entry (f_, struct vm_frame, share_elem);
+  return hash_int ((int)f->block_id) ^ hash_int ((int)f->share_bytes);
 }
 
-/* Returns true if a frame a preceds frame b. */
+/* Returns true if the shared block of frame a precedes frame b's. */
 static bool
-frame_less (const struct hash_elem *a_, const struct hash_elem *b_,
-               void *aux UNUSED)
+share_less (const struct hash_elem *a_, const struct hash_elem *b_,
+            void *aux UNUSED)
 {
-  const struct vm_frame *a = hash_entry (a_, struct vm_frame, hash_elem);
-  const struct vm_frame *b = hash_entry (b_, struct vm_frame, hash_elem);
-  
-  return a->addr < b->addr;
+  const struct vm_frame *a = hash_entry (a_, struct vm_frame, share_elem);
+  const struct vm_frame *b = hash_entry (b_, struct vm_frame, share_elem);
+
+  if (a->block_id != b->block_id)
+    return a->block_id < b->block_id;
+  return a->share_bytes < b->share_bytes;
 }
 
 /* Sets the eviction pointer to the next frame from the frame list. 
    This function will be called when we delete a frame so we don't
-   end up with a dangling pointer. */
+   end up with a dangling pointer. The WSClock leading hand is moved
+   along as well. */
 static void
 eviction_remove_pointer (struct vm_frame *victim)
 {
+  if (e_lead == &victim->list_elem)
+    e_lead = list_next (e_lead);
+
 	if (e_next == NULL || e_next == list_end (&vm_frames_list) )
 		return;
 	struct vm_frame *vf = list_entry (e_next, struct vm_frame, list_elem);
@@ -356,20 +1185,21 @@ eviction_remove_pointer (struct vm_frame *victim)
 		eviction_move_next ();
 }
 
-/* Returns the next frame to be evicted. */
+/* Returns the next frame to be evicted, or a null pointer if there
+   are no frames. */
 static struct vm_frame *
 eviction_get_next (void)
 {
+  if (list_empty (&vm_frames_list))
+    return NULL;
 	if (e_next == NULL || e_next == list_end (&vm_frames_list) )
-  	e_next = list_begin (&vm_frames_list);
-  if (e_next != NULL)
     {
-      /* Get the frame struct from the frame list. */
-		  struct vm_frame *vf = list_entry (e_next, struct vm_frame, list_elem);
-      return vf;
-    }  
+      e_next = list_begin (&vm_frames_list);
+      ws_sweep++;
+    }
 
-  NOT_REACHED ();
+  /* Get the frame struct from the frame list. */
+  return list_entry (e_next, struct vm_frame, list_elem);
 }
 
 /* Moves the clock pointer to the next frame. If we reached the end
@@ -378,7 +1208,10 @@ static void
 eviction_move_next (void)
 {
   if (e_next == NULL || e_next == list_end (&vm_frames_list) )
-    e_next = list_begin (&vm_frames_list);
+    {
+      e_next = list_begin (&vm_frames_list);
+      ws_sweep++;
+    }
   else
     e_next = list_next (e_next); 
 }
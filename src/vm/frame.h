@@ -6,26 +6,71 @@
 #include "threads/palloc.h"
 #include "vm/page.h"
 
+/* Number of pages a frame's reverse map holds inline. Frames mapped
+   by more pages, shared text mostly, keep the rest in an array that
+   grows as needed. */
+#define RMAP_INLINE 4
+
 struct vm_frame 
   {
     void *addr;                 /* Physical address of the frame. */
     bool pinned;                /* If the frame is pinned. */
-    struct hash_elem hash_elem; /* Hash element for the hash frame table. */
-    struct list pages;          /* A list of the pages that share this frame. */
-    struct lock list_lock;      /* A lock to synchronize access to page list. */
+    off_t block_id;             /* Shared read-only block, -1 if private. */
+    size_t share_bytes;         /* Bytes of the shared block it holds. */
+    struct hash_elem share_elem;/* Hash element for the shared frames index. */
+    unsigned attach_cnt;        /* Pages found the frame in the index but
+                                   aren't in its reverse map yet. Protected
+                                   by frame_lock. */
+    struct vm_page *rmap[RMAP_INLINE]; /* Reverse map, the first pages that
+                                   map this frame. */
+    struct vm_page **rmap_more; /* The other pages, or a null pointer. */
+    size_t rmap_cap;            /* Capacity of rmap_more. */
+    size_t rmap_cnt;            /* Number of pages mapping this frame. */
+    struct lock rmap_lock;      /* A lock to synchronize access to rmap. */
 	  struct list_elem list_elem; /* List element for frame list. */
+    bool cleaning;              /* If queued for or being written back. */
+    struct list_elem clean_elem;/* List element for the cleaner queue. */
+  };
+
+/* Page replacement policies. */
+enum vm_evict_policy
+  {
+    EVICT_CLOCK,                /* Single handed clock. */
+    EVICT_WSCLOCK,              /* Two handed clock with write-behind. */
+    EVICT_WS                    /* Clock preferring the frames of processes
+                                   over their working set. */
   };
 
+/* Policy used to pick victim frames. Controlled by the kernel
+   command-line option "-evict". */
+extern enum vm_evict_policy vm_evict_policy;
+
+/* If true, process_exit prints the resident set, working set and 
+   paging counters of the process. Set by the kernel command-line 
+   option "-vm-report". */
+extern bool vm_report;
+
+/* Free user pool pages below which the frame reclaimer wakes up and
+   the number it reclaims up to. Zero disables the reclaimer. Set by
+   the kernel command-line options "-ul-low" and "-ul-high". */
+extern size_t vm_frame_low_mark;
+extern size_t vm_frame_high_mark;
+
 /* Public functions of the frame table. */
 void vm_frame_init (void);
 /* Try to find a frame with the same read-only data. */
-void *vm_lookup_frame (off_t);
+void *vm_lookup_frame (struct vm_page *);
+bool vm_frame_is_shared (struct vm_page *);
+bool vm_frame_make_private (void *);
+void *vm_zero_frame (void);
+void vm_frame_report (struct thread *);
+void vm_frame_remove_page (void *, struct vm_page *);
 /* Obtain a new free frame from memory. */
 void *vm_get_frame (enum palloc_flags flags);
-void vm_free_frame (void *, uint32_t *);
+void vm_free_frame (void *, uint32_t *, void *);
 /* Creates a mapping to the frame's loaded page. */
 bool vm_frame_set_page (void *, struct vm_page *);
-struct vm_page *vm_frame_get_page (void *, uint32_t *);
+struct vm_page *vm_frame_get_page (void *, uint32_t *, void *);
 /* Kernel pin / unpin the given frame. */
 void vm_frame_pin (void *);
 void vm_frame_unpin (void *);
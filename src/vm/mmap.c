@@ -1,23 +1,57 @@
 #include "vm/mmap.h"
 #include <hash.h>
 #include <list.h>
+#include <mman.h>
+#include "devices/timer.h"
+#include "userprog/pagedir.h"
 #include "threads/malloc.h"
+#include "threads/palloc.h"
 #include "threads/thread.h"
 #include "threads/synch.h"
+#include "threads/vaddr.h"
+#include "vm/frame.h"
+#include "vm/page.h"
 
+/* The table lock also keeps a mapping's pages from being freed 
+   while the flusher writes them back, sys_munmap removes the
+   mapping from the table first. The prefetcher reads a whole 
+   mapping in without the lock, it pins the mapping instead and
+   removing a pinned mapping waits on mfile_unpinned. */
 static struct lock mfile_lock;
+static struct condition mfile_unpinned;
 static struct hash vm_mfiles;
 
+int vm_mfile_flush_ticks = TIMER_FREQ;
+
+/* Mappings to read in by the prefetcher thread, queued by
+   MADV_WILLNEED. Protected by mfile_lock. */
+struct prefetch
+  {
+    mapid_t mapid;               /* Mapping to read in. */
+    struct list_elem elem;       /* List elem for the prefetch queue. */
+  };
+static struct list prefetch_queue;
+static struct semaphore prefetch_sema;
+
 static unsigned vm_mfile_hash (const struct hash_elem *, void *);
 static bool vm_mfile_less (const struct hash_elem *, const struct hash_elem *,
                     void *);
+static void mfile_flusher (void *);
+static void mfile_prefetcher (void *);
+static void prefetch_mfile (struct vm_mfile *);
 
 /* Initialise the mmap table. */
 void
 vm_mfile_init (void)
 {
   lock_init (&mfile_lock);
+  cond_init (&mfile_unpinned);
   hash_init (&vm_mfiles, vm_mfile_hash, vm_mfile_less, NULL);
+  list_init (&prefetch_queue);
+  sema_init (&prefetch_sema, 0);
+  if (vm_mfile_flush_ticks > 0)
+    thread_create ("mfile_flusher", PRI_DEFAULT, mfile_flusher, NULL);
+  thread_create ("mfile_prefetcher", PRI_DEFAULT, mfile_prefetcher, NULL);
 }
 
 /* Returns the mfile with the given mapid, or a null pointer if not found. */
@@ -32,7 +66,8 @@ vm_find_mfile (mapid_t mapid)
   return e != NULL ? hash_entry (e, struct vm_mfile, hash_elem) : NULL;
 }
 
-/* Removes the given mapid from the fid. */
+/* Removes the given mapid from the fid. Waits until the mapping
+   is no longer pinned, so its pages can be freed on return. */
 bool
 vm_delete_mfile (mapid_t mapid)
 {
@@ -44,12 +79,101 @@ vm_delete_mfile (mapid_t mapid)
   lock_acquire (&mfile_lock);
   hash_delete (&vm_mfiles, &mf->hash_elem);
   list_remove (&mf->thread_elem);
+  mf->unmapped = true;
+  while (mf->pin_cnt > 0)
+    cond_wait (&mfile_unpinned, &mfile_lock);
   free (mf);
   lock_release (&mfile_lock);
 
   return true; 
 }
 
+/* Removes the remaining mappings of the current process from the
+   table, so the flusher doesn't look at them once its pagedir is
+   destroyed. A process killed by an exception exits without
+   unmapping its files. */
+void
+vm_delete_mfiles (void)
+{
+  struct list *mfiles = &thread_current ()->mfiles;
+
+  while (!list_empty (mfiles))
+    vm_delete_mfile (list_entry (list_front (mfiles), struct vm_mfile,
+                                 thread_elem)->mapid);
+}
+
+/* Writes back the dirty loaded pages of MF to its file, runs of
+   adjacent pages with a single write. If WAIT is false the pages
+   whose lock is held are skipped. */
+void
+vm_sync_mfile (struct vm_mfile *mf, bool wait)
+{
+  uint8_t *addr = mf->start_addr;
+
+  while (addr < (uint8_t *) mf->end_addr)
+    {
+      struct vm_page *page = pagedir_find_page (mf->pagedir, addr);
+      size_t cnt = page != NULL ? vm_sync_pages (page, mf->end_addr, wait) 
+                                : 1;
+      addr += cnt * PGSIZE;
+    }
+}
+
+/* Applies access hint ADVICE to MF. MADV_NORMAL, MADV_SEQUENTIAL
+   and MADV_RANDOM set how far its pages are read around a fault.
+   MADV_WILLNEED queues the mapping for the prefetcher thread and
+   MADV_DONTNEED writes its dirty pages back and frees their frames,
+   the pages are read in again on their next access. Returns false
+   if ADVICE is not a valid hint. */
+bool
+vm_advise_mfile (struct vm_mfile *mf, int advice)
+{
+  uint8_t *addr;
+
+  switch (advice)
+    {
+    case MADV_NORMAL:
+    case MADV_SEQUENTIAL:
+    case MADV_RANDOM:
+      mf->advice = advice;
+      for (addr = mf->start_addr; addr < (uint8_t *) mf->end_addr; 
+           addr += PGSIZE)
+        {
+          struct vm_page *page = pagedir_find_page (mf->pagedir, addr);
+          if (page != NULL)
+            page->file_data.advice = advice;
+        }
+      return true;
+
+    case MADV_WILLNEED:
+      {
+        struct prefetch *p = malloc (sizeof *p);
+        if (p == NULL)
+          return false;
+        p->mapid = mf->mapid;
+        lock_acquire (&mfile_lock);
+        list_push_back (&prefetch_queue, &p->elem);
+        lock_release (&mfile_lock);
+        sema_up (&prefetch_sema);
+        return true;
+      }
+
+    case MADV_DONTNEED:
+      vm_sync_mfile (mf, true);
+      for (addr = mf->start_addr; addr < (uint8_t *) mf->end_addr; 
+           addr += PGSIZE)
+        {
+          struct vm_page *page = pagedir_find_page (mf->pagedir, addr);
+          if (page != NULL && page->loaded)
+            vm_free_frame (page->kpage, page->pagedir, page->addr);
+        }
+      return true;
+
+    default:
+      return false;
+    }
+}
+
 /* Creates a new mfile from a given mapid and a fid. Intserts the new mfile
 in the mfile hash table so it will be found on future lookups. */
 void
@@ -60,6 +184,10 @@ vm_insert_mfile (mapid_t mapid, int fid, void *start_addr, void *end_addr)
   mf->mapid = mapid;
   mf->start_addr = start_addr;
   mf->end_addr = end_addr;
+  mf->pagedir = thread_current ()->pagedir;
+  mf->advice = MADV_NORMAL;
+  mf->pin_cnt = 0;
+  mf->unmapped = false;
 
   /* Insert the new file in the hash table. */
   lock_acquire (&mfile_lock);
@@ -68,6 +196,85 @@ vm_insert_mfile (mapid_t mapid, int fid, void *start_addr, void *end_addr)
   lock_release (&mfile_lock);
 }
 
+/* Flusher thread. Every vm_mfile_flush_ticks it writes back the
+   dirty pages of all memory mapped files, so the amount of dirty 
+   mapped data stays bounded and evicting a mapped page seldom has
+   to write it. */
+static void
+mfile_flusher (void *aux UNUSED)
+{
+  for (;;)
+    {
+      struct hash_iterator i;
+
+      timer_sleep (vm_mfile_flush_ticks);
+      lock_acquire (&mfile_lock);
+      hash_first (&i, &vm_mfiles);
+      while (hash_next (&i))
+        vm_sync_mfile (hash_entry (hash_cur (&i), struct vm_mfile, 
+                                   hash_elem), false);
+      lock_release (&mfile_lock);
+    }
+}
+
+/* Prefetcher thread. Reads in the mappings queued by MADV_WILLNEED
+   while their process goes on running. A mapping unmapped since it
+   was queued is no longer in the table and is skipped. The mapping
+   is pinned rather than the table locked during the reads, so other
+   processes can map and unmap files meanwhile. */
+static void
+mfile_prefetcher (void *aux UNUSED)
+{
+  for (;;)
+    {
+      struct prefetch *p;
+      struct vm_mfile *mf;
+
+      sema_down (&prefetch_sema);
+      lock_acquire (&mfile_lock);
+      p = list_entry (list_pop_front (&prefetch_queue), struct prefetch,
+                      elem);
+      mf = vm_find_mfile (p->mapid);
+      if (mf != NULL)
+        mf->pin_cnt++;
+      lock_release (&mfile_lock);
+      free (p);
+
+      if (mf != NULL)
+        {
+          prefetch_mfile (mf);
+          lock_acquire (&mfile_lock);
+          if (--mf->pin_cnt == 0)
+            cond_broadcast (&mfile_unpinned, &mfile_lock);
+          lock_release (&mfile_lock);
+        }
+    }
+}
+
+/* Reads in the unloaded pages of MF, each read also reads the pages
+   around it. Only free frames are used, we never evict for data 
+   that may not be used. The caller must have pinned MF, which 
+   keeps the mapping's pages from being freed meanwhile. Stops 
+   early once the mapping is being removed. */
+static void
+prefetch_mfile (struct vm_mfile *mf)
+{
+  uint8_t *addr;
+
+  for (addr = mf->start_addr; addr < (uint8_t *) mf->end_addr; 
+       addr += PGSIZE)
+    {
+      struct vm_page *page;
+
+      if (mf->unmapped || palloc_free_cnt (PAL_USER) 
+                          <= vm_frame_low_mark + FAULT_AROUND_MAX + 1)
+        break;
+      page = pagedir_find_page (mf->pagedir, addr);
+      if (page != NULL && !page->loaded)
+        vm_prefetch_page (page);
+    }
+}
+
 /* Returns a hash value for a mfile f. */
 static unsigned
 vm_mfile_hash (const struct hash_elem *mf_, void *aux UNUSED)
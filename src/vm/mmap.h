@@ -2,6 +2,7 @@
 #define VM_MMAP_H
 
 #include <hash.h>
+#include <stdint.h>
 
 /* Map region identifier. */
 typedef int mapid_t;
@@ -15,13 +16,28 @@ struct vm_mfile
     void *start_addr;            /* User virtual address of start and end */
     void *end_addr;              /* of the mapped file as it might span on */
                                  /* multiple pages. */
+    uint32_t *pagedir;           /* Pagedir of the mapping process. */
+    int advice;                  /* Access hint, MADV_* from mman.h. */
+    int pin_cnt;                 /* Threads using the mapping without
+                                    holding the table lock. */
+    bool unmapped;               /* Removed from the table, pinned. */
   };
 
+/* Timer ticks between two write-backs of the dirty pages of all
+   memory mapped files, 0 disables the flusher. Controlled by the
+   kernel command line. */
+extern int vm_mfile_flush_ticks;
+
 /* Initialise the memory mapped files table. */
 void vm_mfile_init (void);
 /* Memory mapped files functions. */
 struct vm_mfile *vm_find_mfile (mapid_t);
 void vm_insert_mfile (mapid_t, int, void *, void *);
 bool vm_delete_mfile (mapid_t);
+void vm_delete_mfiles (void);
+/* Write back the dirty pages of a memory mapped file. */
+void vm_sync_mfile (struct vm_mfile *, bool);
+/* Apply an access hint to a memory mapped file. */
+bool vm_advise_mfile (struct vm_mfile *, int);
 
 #endif /* vm/mmap.h */
@@ -1,33 +1,82 @@
 #include "vm/page.h"
+#include <inttypes.h>
+#include <mman.h>
 #include <stdio.h>
 #include <string.h>
+#include <vmstat.h>
+#include "devices/timer.h"
 #include "userprog/pagedir.h"
 #include "userprog/syscall.h"
+#include "threads/init.h"
+#include "threads/interrupt.h"
 #include "threads/malloc.h"
 #include "threads/palloc.h"
+#include "threads/pte.h"
 #include "threads/thread.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
 #include "vm/frame.h"
 #include "vm/swap.h"
-
-/* Ensure synchronization on load and unload. */
-static struct lock load_lock;
-static struct lock unload_lock;
+#include "vm/zswap.h"
 
 /* Load function for the specific type of page. */
 static bool vm_load_file_page (uint8_t *kpage, struct vm_page *page);
 static void vm_load_swap_page (uint8_t *kpage, struct vm_page *page);
 static void vm_load_zero_page (uint8_t *kpage);
 
+static size_t swap_readahead (struct vm_page *, struct vm_page **);
+static size_t fault_around (struct vm_page *, struct vm_page **);
+static off_t read_file_page (struct vm_page *, void *, off_t);
+static void map_ahead (struct vm_page *);
+static void drop_behind (struct vm_page *);
+static void rss_add (struct thread *, int);
+static struct vm_page *grow_stack (uint8_t *);
+static bool break_cow (struct vm_page *);
+static bool load_page (struct vm_page *, bool pinned, bool write);
+
 static void add_page (struct vm_page *page);
+static bool needs_file_write (struct vm_page *);
+
+/* Number of swapped out pages following a faulting swapped out page,
+   in the following swap slots, which are read in along with it. At
+   most SWAP_READAHEAD_MAX. */
+size_t vm_swap_readahead = SWAP_CLUSTER_PAGES - 1;
+
+/* Number of unloaded file pages following a faulting file page
+   which are read along with it. At most FAULT_AROUND_MAX. */
+size_t vm_fault_around = 4;
+
+/* Large pages mapped into user processes, and 4 MB zero regions
+   which fell back to 4 kB pages for want of an aligned run of free
+   frames. */
+static size_t large_cnt;
+static size_t large_fallback_cnt;
+
+/* Histogram of page fault service times, see vmstat.h. */
+static unsigned fault_latency[VMSTAT_LATENCY_BUCKETS];
+
+/* Buffer for reading a run of file pages with a single read. */
+static uint8_t *fault_buf;
+static struct lock fault_lock;
+
+/* Buffer for writing back a run of dirty memory mapped pages with
+   a single write. */
+static uint8_t *sync_buf;
+static struct lock sync_lock;
+
+/* Memory mapped pages written back by msync and the flusher, and
+   the writes they took. */
+static unsigned long long sync_page_cnt;
+static unsigned long long sync_write_cnt;
 
 /* Initialise the page table locks. */
 void
 vm_page_init (void)
 {
-  lock_init (&load_lock);
-  lock_init (&unload_lock);
+  lock_init (&fault_lock);
+  fault_buf = palloc_get_multiple (PAL_ASSERT, FAULT_AROUND_MAX + 1);
+  lock_init (&sync_lock);
+  sync_buf = palloc_get_multiple (PAL_ASSERT, SYNC_CLUSTER_PAGES);
 }
 
 static int cnt = 0;
@@ -45,14 +94,20 @@ vm_new_file_page (void *addr, struct file *file, off_t ofs, size_t read_bytes,
   page->type = FILE;
   page->addr = addr;
   page->pagedir = thread_current ()->pagedir;
+  page->owner = thread_current ();
   page->file_data.file = file;
   page->file_data.ofs = ofs;
   page->file_data.read_bytes = read_bytes;
   page->file_data.zero_bytes = zero_bytes;
   page->file_data.block_id = block_id;
+  page->file_data.advice = MADV_NORMAL;
   page->writable = writable;
+  page->cow = false;
+  page->large = false;
   page->loaded = false;
   page->kpage = NULL;
+  page->swap_data.clean = false;
+  lock_init (&page->lock);
 
   add_page (page);
 
@@ -71,15 +126,158 @@ vm_new_zero_page (void *addr, bool writable)
   page->type = ZERO;
   page->addr = addr;
   page->pagedir = thread_current ()->pagedir;
+  page->owner = thread_current ();
   page->writable = writable;
+  page->cow = false;
+  page->large = false;
   page->loaded = false;
   page->kpage = NULL;  
+  page->swap_data.clean = false;
+  lock_init (&page->lock);
 
   add_page (page);
 
   return page;
 }
 
+/* Maps the 4 MB of zero memory at ADDR, which must be aligned on
+   LGPGSIZE, with a single large page. The page is allocated and
+   mapped right away and stays resident until the process exits,
+   as eviction and copy-on-write work on 4 kB pages. Its frames 
+   count in the process's resident set. Returns false, and the 
+   caller has to fall back to 4 kB pages, if no aligned run of free
+   frames is left, if taking one would leave fewer free frames than
+   the reclaimer's high mark, or if the range is already partly 
+   mapped. */
+bool
+vm_new_large_zero_page (void *addr, bool writable)
+{
+  struct thread *t = thread_current ();
+  struct vm_page *page;
+  void *kpage;
+
+  if (palloc_free_cnt (PAL_USER) < vm_frame_high_mark + LGPG_CNT)
+    {
+      large_fallback_cnt++;
+      return false;
+    }
+
+  page = malloc (sizeof *page);
+  if (page == NULL)
+    return false;
+
+  kpage = palloc_get_large (PAL_USER | PAL_ZERO);
+  if (kpage == NULL
+      || !pagedir_set_large_page (t->pagedir, addr, kpage, writable))
+    {
+      if (kpage != NULL)
+        palloc_free_multiple (kpage, LGPG_CNT);
+      free (page);
+      large_fallback_cnt++;
+      return false;
+    }
+
+  page->type = ZERO;
+  page->addr = addr;
+  page->pagedir = t->pagedir;
+  page->owner = t;
+  page->writable = writable;
+  page->cow = false;
+  page->large = true;
+  page->loaded = true;
+  page->kpage = kpage;
+  page->swap_data.clean = false;
+  lock_init (&page->lock);
+  list_push_back (&t->vm_large_pages, &page->large_elem);
+  rss_add (t, LGPG_CNT);
+  large_cnt++;
+
+  return true;
+}
+
+/* Frees the large pages of the current process. Its page directory
+   has to be destroyed already. */
+void
+vm_free_large_pages (void)
+{
+  struct thread *t = thread_current ();
+  struct list *pages = &t->vm_large_pages;
+
+  while (!list_empty (pages))
+    {
+      struct list_elem *e = list_pop_front (pages);
+      struct vm_page *page = list_entry (e, struct vm_page, large_elem);
+
+      palloc_free_multiple (page->kpage, LGPG_CNT);
+      rss_add (t, -(int) LGPG_CNT);
+      free (page);
+    }
+}
+
+/* Prints large page statistics and the page fault latency 
+   histogram. */
+void
+vm_page_print_stats (void)
+{
+  size_t i;
+
+  printf ("Large pages: %zu kernel, %zu user, %zu fallbacks\n",
+          init_large_pages, large_cnt, large_fallback_cnt);
+  printf ("Fault latency:");
+  for (i = 0; i < VMSTAT_LATENCY_BUCKETS; i++)
+    if (i == 0)
+      printf (" 0 ticks %u,", fault_latency[i]);
+    else if (i < VMSTAT_LATENCY_BUCKETS - 1)
+      printf (" %d-%d %u,", 1 << (i - 1), (1 << i) - 1, fault_latency[i]);
+    else
+      printf (" %d+ %u\n", 1 << (i - 1), fault_latency[i]);
+  printf ("Mmap sync: %llu pages written back in %llu writes\n",
+          sync_page_cnt, sync_write_cnt);
+}
+
+/* Adds a page fault which took TICKS timer ticks to serve to the 
+   latency histogram. */
+void
+vm_page_count_fault (int64_t ticks)
+{
+  size_t i = 0;
+
+  while (ticks > 0 && i < VMSTAT_LATENCY_BUCKETS - 1)
+    {
+      ticks >>= 1;
+      i++;
+    }
+  fault_latency[i]++;
+}
+
+/* Stores the paging statistics of process T and the fault latency
+   histogram in STATS. */
+void
+vm_page_get_stats (struct thread *t, struct vmstat *stats)
+{
+  stats->faults = t->vm_faults;
+  stats->minor_faults = t->vm_minor_faults;
+  stats->major_faults = t->vm_major_faults;
+  stats->stack_faults = t->vm_stack_faults;
+  stats->swap_ins = t->vm_swap_ins;
+  stats->swap_outs = t->vm_swap_outs;
+  stats->file_writes = t->vm_file_writes;
+  stats->evictions = t->vm_evictions;
+  stats->load_ticks = t->vm_load_ticks;
+  memcpy (stats->latency, fault_latency, sizeof fault_latency);
+}
+
+/* Prints the paging statistics of process T. */
+void
+vm_page_report (struct thread *t)
+{
+  printf ("%s: %u minor, %u major, %u stack faults, %u swap-ins, "
+          "%u swap-outs, %u file writes, %"PRId64" ticks loading\n",
+          t->name, t->vm_minor_faults, t->vm_major_faults, 
+          t->vm_stack_faults, t->vm_swap_ins, t->vm_swap_outs,
+          t->vm_file_writes, t->vm_load_ticks);
+}
+
 /* Pins a page into memory. */
 void
 vm_pin_page (struct vm_page *page)
@@ -102,27 +300,73 @@ vm_unpin_page (struct vm_page *page)
    is true the frame will be left pinned and the caller has
    to unpin it after usage. This is helpful on read / write
    operation and makes sure the frame won't be evicted by
-   another thread in meantime. */
+   another thread in meantime. A page which is already loaded
+   is only pinned. */
 bool 
 vm_load_page (struct vm_page *page, bool pinned)
 {
-  /* Get a frame of memory. */
-  lock_acquire (&load_lock);
-  
-  /* If we have a read-only file try to look for a frame if any
-     that contains the same data. */
-  if (page->type == FILE && page->file_data.block_id != -1)
-    page->kpage = vm_lookup_frame (page->file_data.block_id);
+  int64_t start = timer_ticks ();
+  bool success;
+
+  lock_acquire (&page->lock);
+  success = load_page (page, pinned, false);
+  lock_release (&page->lock);
+  page->owner->vm_load_ticks += timer_elapsed (start);
+  return success;
+}
+
+/* Loads PAGE as vm_load_page does. Unless WRITE is true a zero page
+   maps the shared zero frame instead of a frame of its own. The 
+   caller must hold the page's lock, so there is no global lock on
+   the fault path and faults on different pages run in parallel. */
+static bool
+load_page (struct vm_page *page, bool pinned, bool write)
+{
+  bool shared = false;
+  bool private = false;
+  bool success = true;
+  bool major;
+
+  /* The page was loaded while we waited for its lock, by read ahead
+     or because an eviction we raced with gave up. */
+  if (page->loaded)
+    {
+      if (pinned)
+        vm_frame_pin (page->kpage);
+      return true;
+    }
+
+  /* If we have a pristine file block try to look for a frame if any
+     that contains the same data. Reads of zero pages use the zero
+     frame. Writable pages map these frames copy-on-write. A frame 
+     is only published once its data is in place, so a frame found
+     needs no read. Two processes loading the same block at once may
+     both read it, the second frame then just stays private. A write
+     fault on a block no frame holds reads it into a frame that is
+     never published, the page is about to write to it. */
+  if (page->type == ZERO && !write)
+    page->kpage = vm_zero_frame ();
+  else if (vm_page_share_id (page) != -1)
+    {
+      page->kpage = vm_lookup_frame (page);
+      shared = page->kpage != NULL;
+      private = !shared && write && page->writable;
+    }
+  page->cow = page->writable && !private
+              && (page->kpage != NULL || vm_page_share_id (page) != -1);
   /* Otherwise obtain an empty frame from the frame table. */
   if (page->kpage == NULL)
     page->kpage = vm_get_frame (PAL_USER);
 
-  lock_release (&load_lock);
-  vm_frame_set_page (page->kpage, page);
-
-  bool success = true;
-  /* Performs the specific loading operation. */
-  if (page->type == FILE)
+  /* Performs the specific loading operation. Only file data and
+     pages on the swap device cost a disk read. */
+  major = !shared 
+          && ((page->type == FILE && page->file_data.read_bytes > 0)
+              || (page->type == SWAP 
+                  && !vm_zswap_owns (page->swap_data.index)));
+  if (shared || page->kpage == vm_zero_frame ())
+    ;
+  else if (page->type == FILE)
     success = vm_load_file_page (page->kpage, page);
   else if (page->type == ZERO)
     vm_load_zero_page (page->kpage);
@@ -131,13 +375,32 @@ vm_load_page (struct vm_page *page, bool pinned)
 
   if (!success)
     {
-      vm_frame_unpin (page->kpage);
+      page->kpage = NULL;
+      return false;
+    }
+  /* Like a page that broke copy-on-write, a private copy of a block
+     is anonymous memory. It becomes a swap page before it is added 
+     to its frame, so the frame isn't published. */
+  if (private)
+    page->type = SWAP;
+  /* vm_lookup_frame already added the page to a shared frame. Adding
+     it to the zero frame may run out of memory for the reverse map,
+     a new frame always has room. A page missing from its frame's
+     reverse map would never be unmapped, so we fail and drop the 
+     frame. */
+  if (!shared && !vm_frame_set_page (page->kpage, page))
+    {
+      vm_free_frame (page->kpage, page->pagedir, page->addr);
+      if (private)
+        page->type = FILE;
+      page->kpage = NULL;
       return false;
     }
 
   /* Clear any previous mapping and set a new one. */
   pagedir_clear_page (page->pagedir, page->addr);
-  if (!pagedir_set_page (page->pagedir, page->addr, page->kpage, page->writable) )
+  if (!pagedir_set_page (page->pagedir, page->addr, page->kpage, 
+                         page->writable && !page->cow) )
     {
       ASSERT (false);
       vm_frame_unpin (page->kpage);
@@ -148,20 +411,142 @@ vm_load_page (struct vm_page *page, bool pinned)
   pagedir_set_accessed (page->pagedir, page->addr, true);
 
   page->loaded = true;
+  rss_add (page->owner, 1);
+  /* Loads by the prefetcher thread are not faults of the owner. */
+  if (page->owner != thread_current ())
+    ;
+  else if (major)
+    page->owner->vm_major_faults++;
+  else
+    page->owner->vm_minor_faults++;
   /* On succes we leave the frame pinned if the caller wants so. */
   if (!pinned)
     vm_frame_unpin (page->kpage);
   return true;
 }
 
+/* Loads the unloaded file PAGE for a process that announced it
+   will need it, along with the pages read around it. Unlike 
+   vm_load_page it never waits: a page whose lock is held is being
+   loaded or unloaded already. Returns true if the page was read. */
+bool
+vm_prefetch_page (struct vm_page *page)
+{
+  bool success = false;
+
+  if (!lock_try_acquire (&page->lock))
+    return false;
+  if (!page->loaded && page->type == FILE)
+    {
+      success = load_page (page, false, false);
+      /* Like the pages read around it, it wasn't used yet. */
+      if (success)
+        pagedir_set_accessed (page->pagedir, page->addr, false);
+    }
+  lock_release (&page->lock);
+  return success;
+}
+
+/* Loads a page like vm_load_page into a frame it can write to. If
+   the page shares its frame copy-on-write it gets a private copy.
+   Used on write faults and before the kernel writes to a user page,
+   as the kernel doesn't fault on read-only user mappings. */
+bool
+vm_load_page_for_write (struct vm_page *page, bool pinned)
+{
+  int64_t start = timer_ticks ();
+
+  lock_acquire (&page->lock);
+  if (!load_page (page, true, true))
+    {
+      lock_release (&page->lock);
+      return false;
+    }
+
+  if (page->cow)
+    {
+      if (!break_cow (page))
+        {
+          vm_frame_unpin (page->kpage);
+          lock_release (&page->lock);
+          return false;
+        }
+      page->owner->vm_minor_faults++;
+    }
+
+  if (!pinned)
+    vm_frame_unpin (page->kpage);
+  lock_release (&page->lock);
+  page->owner->vm_load_ticks += timer_elapsed (start);
+  return true;
+}
+
+/* Copy-on-write - Gives PAGE, loaded and pinned, a frame of its own
+   and maps it writable. If no other page shares its frame any more
+   the frame is just made private, otherwise its content is copied
+   to a new frame. The page is anonymous memory from now on, so it
+   becomes a swap page. Returns false, leaving the page shared, if
+   it can't be added to the new frame. */
+static bool
+break_cow (struct vm_page *page)
+{
+  void *old = page->kpage;
+  enum vm_page_type type = page->type;
+
+  if (vm_frame_make_private (old))
+    page->type = SWAP;
+  else
+    {
+      void *kpage = vm_get_frame (PAL_USER);
+
+      memcpy (kpage, old, PGSIZE);
+      page->type = SWAP;
+      page->kpage = kpage;
+      if (!vm_frame_set_page (kpage, page))
+        {
+          vm_free_frame (kpage, page->pagedir, page->addr);
+          page->type = type;
+          page->kpage = old;
+          return false;
+        }
+      vm_frame_remove_page (old, page);
+    }
+
+  page->cow = false;
+  pagedir_clear_page (page->pagedir, page->addr);
+  pagedir_set_page (page->pagedir, page->addr, page->kpage, true);
+  pagedir_set_accessed (page->pagedir, page->addr, true);
+  return true;
+}
+
+/* Returns the key under which the frame of PAGE can be shared with
+   other pages holding the same data, or -1 if the page needs a
+   frame of its own. Pristine blocks of executables are shared by 
+   their block number. */
+off_t
+vm_page_share_id (struct vm_page *page)
+{
+  if (page->type == FILE)
+    return page->file_data.block_id;
+  return -1;
+}
+
 /* Unloads a page by writing its content back to disk if the file
    is writable or to swap if not. Clears the mapping and sets 
-   the pagedir entry to point to the page struct. */
+   the pagedir entry to point to the page struct first, so the 
+   owner can't change the page during the write, a fault on it 
+   waits for the page's lock. The caller must hold the lock. */
 void
 vm_unload_page (struct vm_page *page, void *kpage)
 {
-  lock_acquire (&unload_lock);
-  if (page->type == FILE && pagedir_is_dirty (page->pagedir, page->addr) &&
+  bool dirty = pagedir_is_dirty (page->pagedir, page->addr);
+
+  ASSERT (lock_held_by_current_thread (&page->lock));
+
+  pagedir_clear_page (page->pagedir, page->addr);
+  pagedir_add_page (page->pagedir, page->addr, (void *)page);
+
+  if (page->type == FILE && dirty &&
       file_writable (page->file_data.file) == false)
     {
       /* Write the page back to the file. */
@@ -172,45 +557,393 @@ vm_unload_page (struct vm_page *page, void *kpage)
       file_write (page->file_data.file, kpage, page->file_data.read_bytes);
       sys_t_filelock (false);
       vm_frame_unpin (kpage);
+      page->owner->vm_file_writes++;
+    }
+  else if (page->swap_data.clean && !dirty)
+    {
+      /* The page cleaner already stored an up to date copy. */
+      page->type = SWAP;
     }
-  else if (page->type == SWAP || pagedir_is_dirty (page->pagedir, page->addr))
+  else if (page->type == SWAP || dirty)
     {
-      /* Store the page to swap. */
+      /* Store the page to swap, dropping any stale copy. */
+      if (page->swap_data.clean)
+        vm_swap_free (page->swap_data.index);
       page->type = SWAP;
       page->swap_data.index = vm_swap_store (kpage);
+      page->owner->vm_swap_outs++;
     }
-  lock_release (&unload_lock);
+  page->swap_data.clean = false;
 
-  pagedir_clear_page (page->pagedir, page->addr);
-  pagedir_add_page (page->pagedir, page->addr, (void *)page);
   page->loaded = false;
   page->kpage = NULL;
+  rss_add (page->owner, -1);
+}
+
+/* Returns true if vm_unload_page would write the page to swap. */
+bool
+vm_page_needs_swap (struct vm_page *page)
+{
+  bool dirty = pagedir_is_dirty (page->pagedir, page->addr);
+
+  if (page->type == FILE && dirty &&
+      file_writable (page->file_data.file) == false)
+    return false;
+  if (page->swap_data.clean && !dirty)
+    return false;
+  return page->type == SWAP || dirty;
+}
+
+/* Unloads CNT pages, at most SWAP_CLUSTER_PAGES, which all need
+   to be written to swap. KPAGES holds the frame of each page. The
+   pages go to consecutive swap slots, so the eviction of several 
+   frames costs a single disk write. The caller must hold the lock
+   of each page. */
+void
+vm_unload_swap_cluster (struct vm_page **pages, void **kpages, size_t cnt)
+{
+  size_t indexes[SWAP_CLUSTER_PAGES];
+  size_t i;
+
+  ASSERT (cnt <= SWAP_CLUSTER_PAGES);
+
+  for (i = 0; i < cnt; i++)
+    {
+      ASSERT (lock_held_by_current_thread (&pages[i]->lock));
+      pagedir_clear_page (pages[i]->pagedir, pages[i]->addr);
+      pagedir_add_page (pages[i]->pagedir, pages[i]->addr, pages[i]);
+
+      /* Drop any stale copy stored by the page cleaner. */
+      if (pages[i]->swap_data.clean)
+        vm_swap_free (pages[i]->swap_data.index);
+      pages[i]->swap_data.clean = false;
+      pages[i]->type = SWAP;
+    }
+  vm_swap_store_cluster (kpages, cnt, indexes);
+
+  for (i = 0; i < cnt; i++)
+    {
+      struct vm_page *page = pages[i];
+
+      page->swap_data.index = indexes[i];
+      page->owner->vm_swap_outs++;
+      page->loaded = false;
+      page->kpage = NULL;
+      rss_add (page->owner, -1);
+    }
+}
+
+/* Returns true if the page can be unloaded without any write, because
+   its content can be restored from its file, from zeroes or from
+   a copy the page cleaner already stored in swap. */
+bool
+vm_page_is_clean (struct vm_page *page)
+{
+  if (pagedir_is_dirty (page->pagedir, page->addr))
+    return false;
+  return page->type != SWAP || page->swap_data.clean;
+}
+
+/* Writes a loaded page back to the same store vm_unload_page would
+   use but leaves it mapped, so that a later eviction of the frame
+   doesn't have to wait for the write. The dirty bit is cleared
+   before the write, so any store racing with it dirties the page
+   again. Used by the background page cleaner. A page whose lock
+   is held, by its owner breaking copy-on-write for instance, is
+   skipped and left dirty. */
+void
+vm_clean_page (struct vm_page *page, void *kpage)
+{
+  if (vm_page_is_clean (page) || !lock_try_acquire (&page->lock))
+    return;
+
+  bool dirty = pagedir_is_dirty (page->pagedir, page->addr);
+  pagedir_set_dirty (page->pagedir, page->addr, false);
+
+  if (page->type == FILE && dirty &&
+      file_writable (page->file_data.file) == false)
+    {
+      sys_t_filelock (true);
+      file_write_at (page->file_data.file, kpage, 
+                     page->file_data.read_bytes, page->file_data.ofs);
+      sys_t_filelock (false);
+      page->owner->vm_file_writes++;
+    }
+  else
+    {
+      if (page->swap_data.clean)
+        vm_swap_free (page->swap_data.index);
+      page->swap_data.index = vm_swap_store (kpage);
+      page->swap_data.clean = true;
+      page->owner->vm_swap_outs++;
+    }
+  lock_release (&page->lock);
+}
+
+/* Writes back PAGE, if it is a dirty loaded page of a memory mapped
+   file, along with the dirty loaded pages mapped after it, up to
+   END, which hold the following data of the same file. At most 
+   SYNC_CLUSTER_PAGES pages are copied to the sync buffer, their 
+   dirty bits cleared as in vm_clean_page, and written with a single
+   write. As in vm_clean_page their locks are held until the write
+   is done, otherwise an eviction could drop a page that looks clean
+   and a refault read the old data back from the file before the
+   write. If WAIT is false a page whose lock is held is skipped. The locks of the pages after PAGE
+   are only tried, we never wait for one while holding another.
+   Returns the number of pages written, or 1 if PAGE was not, so 
+   the caller can move on to the page that follows. */
+size_t
+vm_sync_pages (struct vm_page *page, void *end, bool wait)
+{
+  struct vm_page *run[SYNC_CLUSTER_PAGES];
+  struct file *file = page->file_data.file;
+  size_t cnt = 0, i;
+  off_t size;
+
+  if (!page->loaded || page->type != FILE)
+    return 1;
+
+  lock_acquire (&sync_lock);
+  if (wait)
+    lock_acquire (&page->lock);
+  else if (!lock_try_acquire (&page->lock))
+    {
+      lock_release (&sync_lock);
+      return 1;
+    }
+  if (!needs_file_write (page))
+    {
+      lock_release (&page->lock);
+      lock_release (&sync_lock);
+      return 1;
+    }
+  run[cnt++] = page;
+
+  while (cnt < SYNC_CLUSTER_PAGES)
+    {
+      struct vm_page *prev = run[cnt - 1];
+      uint8_t *addr = (uint8_t *) prev->addr + PGSIZE;
+      struct vm_page *p;
+
+      if (addr >= (uint8_t *) end || prev->file_data.read_bytes != PGSIZE)
+        break;
+      p = pagedir_find_page (page->pagedir, addr);
+      if (p == NULL || !lock_try_acquire (&p->lock))
+        break;
+      if (!needs_file_write (p) || p->file_data.file != file
+          || p->file_data.ofs != prev->file_data.ofs + PGSIZE)
+        {
+          lock_release (&p->lock);
+          break;
+        }
+      run[cnt++] = p;
+    }
+
+  for (i = 0; i < cnt; i++)
+    {
+      struct vm_page *p = run[i];
+
+      pagedir_set_dirty (p->pagedir, p->addr, false);
+      memcpy (sync_buf + i * PGSIZE, p->kpage, PGSIZE);
+      p->owner->vm_file_writes++;
+    }
+  size = (cnt - 1) * PGSIZE + run[cnt - 1]->file_data.read_bytes;
+
+  sys_t_filelock (true);
+  file_write_at (file, sync_buf, size, page->file_data.ofs);
+  sys_t_filelock (false);
+  for (i = 0; i < cnt; i++)
+    lock_release (&run[i]->lock);
+  sync_page_cnt += cnt;
+  sync_write_cnt++;
+  lock_release (&sync_lock);
+
+  return cnt;
+}
+
+/* Returns true if PAGE is loaded and unloading it would write it
+   back to its file. The caller must hold the page's lock. */
+static bool
+needs_file_write (struct vm_page *page)
+{
+  return page->loaded && page->type == FILE 
+         && file_writable (page->file_data.file) == false
+         && pagedir_is_dirty (page->pagedir, page->addr);
 }
 
 /* Loads a file page into the given frame. Reads read_bytes from 
-   the file and sets the remaining bytes to 0. */
+   the file and sets the remaining bytes to 0. The unloaded pages 
+   of the same file that follow it are read with the same read and
+   mapped without their accessed bit set. If another fault is using
+   the read around buffer only the page itself is read, straight 
+   into its frame, rather than waiting for that fault's read. */
 static bool
 vm_load_file_page (uint8_t *kpage, struct vm_page *page)
 {
-  /* Read the content of the page from file. */
+  struct vm_page *around[FAULT_AROUND_MAX];
+  size_t cnt = fault_around (page, around);
+  bool success = false;
+  size_t ret, i;
 
-  sys_t_filelock (true);
-  file_seek (page->file_data.file, page->file_data.ofs);
-  size_t ret = file_read (page->file_data.file, kpage, 
-                          page->file_data.read_bytes);
-  sys_t_filelock (false);
-   
-  if (ret != page->file_data.read_bytes)
+  if (cnt > 0 && lock_try_acquire (&fault_lock))
     {
-      vm_free_frame (kpage, page->pagedir);
+      size_t bytes = cnt * PGSIZE + around[cnt - 1]->file_data.read_bytes;
+
+      ret = read_file_page (page, fault_buf, bytes);
+
+      if (ret >= page->file_data.read_bytes)
+        {
+          memcpy (kpage, fault_buf, PGSIZE);
+          for (i = 0; i < cnt; i++)
+            {
+              struct vm_page *p = around[i];
+              uint8_t *data = fault_buf + (i + 1) * PGSIZE;
+
+              /* Stop at the first page the read didn't cover. */
+              if (ret < (i + 1) * PGSIZE + p->file_data.read_bytes)
+                break;
+              p->kpage = vm_get_frame (PAL_USER);
+              memcpy (p->kpage, data, p->file_data.read_bytes);
+              memset (p->kpage + p->file_data.read_bytes, 0, 
+                      p->file_data.zero_bytes);
+              if (!vm_frame_set_page (p->kpage, p))
+                {
+                  vm_free_frame (p->kpage, p->pagedir, p->addr);
+                  p->kpage = NULL;
+                  break;
+                }
+              map_ahead (p);
+            }
+          success = true;
+        }
+      lock_release (&fault_lock);
+    }
+  else
+    {
+      /* Read the content of the page from file. */
+      ret = read_file_page (page, kpage, page->file_data.read_bytes);
+      if (ret == page->file_data.read_bytes)
+        {
+          /* Fill the rest of the page with zeroes. */
+          memset (kpage + page->file_data.read_bytes, 0, 
+                  page->file_data.zero_bytes);
+          success = true;
+        }
+    }
+
+  for (i = 0; i < cnt; i++)
+    lock_release (&around[i]->lock);
+  if (!success)
+    {
+      vm_free_frame (kpage, page->pagedir, page->addr);
       return false;
     }
-  
-  /* Fill the rest of the page with zeroes. */
-  memset (kpage + page->file_data.read_bytes, 0, page->file_data.zero_bytes);
+  if (page->file_data.advice == MADV_SEQUENTIAL)
+    drop_behind (page);
   return true;
 }
 
+/* Clears the accessed bits of the loaded pages of the same file
+   in the FAULT_AROUND_MAX + 1 pages before PAGE, which belongs to 
+   a mapping read sequentially. The part of the stream already read
+   is then evicted before the pages other processes keep using. */
+static void
+drop_behind (struct vm_page *page)
+{
+  size_t i;
+
+  for (i = 1; i <= FAULT_AROUND_MAX + 1; i++)
+    {
+      struct vm_page *p;
+
+      if ((uintptr_t) page->addr < i * PGSIZE)
+        break;
+      p = pagedir_find_page (page->pagedir, 
+                             (uint8_t *) page->addr - i * PGSIZE);
+      if (p == NULL || !lock_try_acquire (&p->lock))
+        break;
+      if (p->type != FILE || p->file_data.file != page->file_data.file)
+        {
+          lock_release (&p->lock);
+          break;
+        }
+      if (p->loaded)
+        pagedir_set_accessed (p->pagedir, p->addr, false);
+      lock_release (&p->lock);
+    }
+}
+
+/* Reads SIZE bytes of the file of PAGE, from the page's offset on,
+   into BUFFER and returns the number of bytes read. Executables 
+   deny writes while they run, so their pages are read without the
+   file system lock. The faulting thread then only waits for its 
+   own disk request, and page-ins of other processes, or swap-ins 
+   on the other IDE channel, proceed meanwhile. */
+static off_t
+read_file_page (struct vm_page *page, void *buffer, off_t size)
+{
+  bool locked = !file_writable (page->file_data.file);
+  off_t ret;
+
+  if (locked)
+    sys_t_filelock (true);
+  ret = file_read_at (page->file_data.file, buffer, size, 
+                      page->file_data.ofs);
+  if (locked)
+    sys_t_filelock (false);
+  return ret;
+}
+
+/* Finds the unloaded pages following PAGE which hold the following
+   data of the same file, at most vm_fault_around of them, or 
+   FAULT_AROUND_MAX or none if the mapping is read sequentially or
+   randomly, locks them and stores them in AROUND. Pages of 
+   read-only blocks which another process already has in a frame are
+   left to be shared on their own fault. Stops at a page whose lock
+   is held, and when free frames run low, we never evict for a page
+   that may not be used. Returns the number of pages found, the 
+   caller releases their locks. */
+static size_t
+fault_around (struct vm_page *page, struct vm_page **around)
+{
+  size_t window = vm_fault_around < FAULT_AROUND_MAX 
+                  ? vm_fault_around : FAULT_AROUND_MAX;
+  struct vm_page *prev = page;
+  size_t cnt;
+
+  if (page->file_data.advice == MADV_SEQUENTIAL)
+    window = FAULT_AROUND_MAX;
+  else if (page->file_data.advice == MADV_RANDOM)
+    window = 0;
+
+  for (cnt = 0; cnt < window; cnt++)
+    {
+      uint8_t *addr = (uint8_t *) page->addr + (cnt + 1) * PGSIZE;
+      struct vm_page *p;
+
+      if (prev->file_data.read_bytes != PGSIZE || !is_user_vaddr (addr)
+          || palloc_free_cnt (PAL_USER) <= vm_frame_low_mark + cnt)
+        break;
+      p = pagedir_find_page (page->pagedir, addr);
+      if (p == NULL || !lock_try_acquire (&p->lock))
+        break;
+      if (p->loaded || p->type != FILE
+          || p->file_data.file != page->file_data.file
+          || p->file_data.ofs != prev->file_data.ofs + PGSIZE
+          || p->file_data.read_bytes == 0
+          || (p->file_data.block_id != -1 && vm_frame_is_shared (p)))
+        {
+          lock_release (&p->lock);
+          break;
+        }
+
+      around[cnt] = p;
+      prev = p;
+    }
+
+  return cnt;
+}
+
 /* To load a zero page we just have to set everything to 0. Usually
    pages wont't remain all zeros when they are swapped in. */
 static void
@@ -221,24 +954,151 @@ vm_load_zero_page (uint8_t *kpage)
 }
 
 /* Loads a page from the swap into main memory and frees
-   the underlying swap slot. */
+   the underlying swap slot. The pages that follow it in the
+   address space and in swap are read in with the same request and
+   mapped without their accessed bit set, so if they are not used
+   soon the clock hand will pick them first. */
 static void
 vm_load_swap_page (uint8_t *kpage, struct vm_page *page)
 {
-  /* Read the content from swap and free the swap slot. */
-  vm_swap_load (page->swap_data.index, kpage);
+  struct vm_page *ahead[SWAP_READAHEAD_MAX];
+  void *kpages[SWAP_READAHEAD_MAX + 1];
+  size_t cnt, i;
+
+  cnt = swap_readahead (page, ahead);
+  page->owner->vm_swap_ins += cnt + 1;
+  kpages[0] = kpage;
+  for (i = 0; i < cnt; i++)
+    kpages[i + 1] = ahead[i]->kpage;
+
+  /* Read the content from swap and free the swap slots. */
+  vm_swap_load_cluster (page->swap_data.index, kpages, cnt + 1);
   vm_swap_free (page->swap_data.index);
+
+  for (i = 0; i < cnt; i++)
+    {
+      struct vm_page *p = ahead[i];
+
+      vm_swap_free (p->swap_data.index);
+      map_ahead (p);
+      lock_release (&p->lock);
+    }
+}
+
+/* Maps page P, read ahead into its pinned frame, without setting its
+   accessed bit and unpins the frame. Writable pages of shared data 
+   are mapped copy-on-write. */
+static void
+map_ahead (struct vm_page *p)
+{
+  p->cow = p->writable && vm_page_share_id (p) != -1;
+  pagedir_clear_page (p->pagedir, p->addr);
+  pagedir_set_page (p->pagedir, p->addr, p->kpage, p->writable && !p->cow);
+  pagedir_set_dirty (p->pagedir, p->addr, false);
+  pagedir_set_accessed (p->pagedir, p->addr, false);
+  p->loaded = true;
+  rss_add (p->owner, 1);
+  vm_frame_unpin (p->kpage);
 }
 
-/* Creates a new zero page at the top of the thread's stack 
-   address space. Then loads the page into memory. */
+/* Finds the swapped out pages following PAGE whose swap slots
+   follow PAGE's slot, at most vm_swap_readahead of them, and gets
+   a pinned frame for each one. Only free frames are used, we never
+   evict for a page that may not be used. Each page is locked, and
+   we stop at a page whose lock is held, it is being loaded or 
+   unloaded. Stores the pages in AHEAD and returns their number,
+   the caller releases their locks. */
+static size_t
+swap_readahead (struct vm_page *page, struct vm_page **ahead)
+{
+  size_t window = vm_swap_readahead < SWAP_READAHEAD_MAX 
+                  ? vm_swap_readahead : SWAP_READAHEAD_MAX;
+  size_t cnt;
+
+  /* Pages kept in the compressed swap pool cost no disk read. */
+  if (vm_zswap_owns (page->swap_data.index))
+    return 0;
+
+  for (cnt = 0; cnt < window; cnt++)
+    {
+      uint8_t *addr = (uint8_t *) page->addr + (cnt + 1) * PGSIZE;
+      struct vm_page *p;
+
+      if (!is_user_vaddr (addr)
+          || palloc_free_cnt (PAL_USER) <= vm_frame_low_mark)
+        break;
+      p = pagedir_find_page (page->pagedir, addr);
+      if (p == NULL || !lock_try_acquire (&p->lock))
+        break;
+      if (p->loaded || p->type != SWAP
+          || p->swap_data.index 
+             != page->swap_data.index + (cnt + 1) * BLOCKS_PER_PAGE)
+        {
+          lock_release (&p->lock);
+          break;
+        }
+
+      p->kpage = vm_get_frame (PAL_USER);
+      if (!vm_frame_set_page (p->kpage, p))
+        {
+          vm_free_frame (p->kpage, p->pagedir, p->addr);
+          p->kpage = NULL;
+          lock_release (&p->lock);
+          break;
+        }
+      ahead[cnt] = p;
+    }
+
+  return cnt;
+}
+
+/* Grows the current process's stack down to UPAGE. Creates a zero
+   page for UPAGE and for every unmapped page between it and the 
+   previous bottom of the stack, which a large stack frame skipped,
+   and loads up to STACK_PREMAP_MAX - 1 of the pages above UPAGE 
+   right away, as far as free frames allow, so writing a large
+   object on the stack doesn't fault once per page. UPAGE itself is
+   left to the caller to load. Returns UPAGE's page, or a null 
+   pointer if out of memory. */
+static struct vm_page *
+grow_stack (uint8_t *upage)
+{
+  struct vm_page *page = NULL;
+  uint8_t *addr;
+  size_t cnt;
+
+  for (addr = upage, cnt = 0; addr < (uint8_t *) PHYS_BASE 
+       && vm_find_page (addr) == NULL; addr += PGSIZE, cnt++)
+    {
+      struct vm_page *p = vm_new_zero_page (addr, true);
+      if (p == NULL)
+        return NULL;
+      p->owner->vm_stack_faults++;
+      if (page == NULL)
+        page = p;
+      else if (cnt < STACK_PREMAP_MAX 
+               && palloc_free_cnt (PAL_USER) > vm_frame_low_mark + cnt)
+        vm_load_page_for_write (p, false);
+    }
+
+  return page;
+}
+
+/* Returns the page of the current process that holds user address
+   ADDR. An unmapped address in the reserved stack region grows the
+   stack down to it, if it is at most STACK_SLACK bytes below the
+   user stack pointer ESP: PUSHA writes 32 bytes below ESP before it
+   moves ESP. Anything further below ESP is not part of the stack
+   yet. Returns a null pointer if ADDR is not mapped. */
 struct vm_page *
-vm_grow_stack (void *uva, bool pinned)
+vm_find_user_page (void *addr, const void *esp)
 {
-  struct vm_page *page = vm_new_zero_page (uva, true);
-  if ( !vm_load_page (page, pinned) )
-    return NULL;
+  uint8_t *upage = pg_round_down (addr);
+  struct vm_page *page = vm_find_page (upage);
 
+  if (page == NULL && vm_stack_region (addr) 
+      && (uint8_t *) addr >= (const uint8_t *) esp - STACK_SLACK)
+    page = grow_stack (upage);
   return page;
 }
 
@@ -250,9 +1110,22 @@ vm_find_page (void *addr)
 {
   uint32_t *pagedir = thread_current ()->pagedir;
   struct vm_page *page = NULL;
+  struct list *large = &thread_current ()->vm_large_pages;
+  struct list_elem *e;
+
   page = (struct vm_page *) pagedir_find_page (pagedir, (const void *)addr);
+  if (page != NULL || list_empty (large))
+    return page;
 
-  return page;
+  /* Addresses in a large page have no page table entry. */
+  for (e = list_begin (large); e != list_end (large); e = list_next (e))
+    {
+      page = list_entry (e, struct vm_page, large_elem);
+      if (pg_round_down (addr) >= page->addr 
+          && pg_round_down (addr) < page->addr + LGPGSIZE)
+        return page;
+    }
+  return NULL;
 }
 
 /* Stores inside the page table entry a pointer to the page struct
@@ -271,7 +1144,8 @@ vm_free_page (struct vm_page *page)
     return;
   
   /* Free the swap data of the page if necessary. */
-  if (page->type == SWAP && page->loaded == false)
+  if ((page->type == SWAP && page->loaded == false) || 
+      page->swap_data.clean)
     vm_swap_free (page->swap_data.index);
 
   /* Clear the mapping from the thread's pagedir. */
@@ -280,13 +1154,23 @@ vm_free_page (struct vm_page *page)
   --cnt;
 }
 
-/* Use a heuristic to check for stack access. We check if the
-   address is in the user space and the fault access is at 
-   most 32 bytes below the stack pointer. */
+/* Returns true if ADDR lies in the stack region reserved below 
+   PHYS_BASE, above its guard page. */
 bool
-stack_access (const void *esp, void *addr)
+vm_stack_region (const void *addr)
 {
-  return (uint32_t)addr > 0 && addr >= (esp - 32) &&
-     (PHYS_BASE - pg_round_down (addr)) <= (1<<23);
+  return (const uint8_t *) addr >= STACK_LIMIT && is_user_vaddr (addr);
 }
 
+
+/* Adds CNT to the resident set size of process T. Other threads
+   load and unload the pages of a process too, the prefetcher and
+   evicting processes, each under the lock of a different page, so
+   the update is made with interrupts off. */
+static void
+rss_add (struct thread *t, int cnt)
+{
+  enum intr_level old_level = intr_disable ();
+  t->vm_rss += cnt;
+  intr_set_level (old_level);
+}
@@ -4,7 +4,13 @@
 #include <list.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 #include "filesys/file.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+struct thread;
+struct vmstat;
 
 enum vm_page_type
   {
@@ -18,10 +24,18 @@ struct vm_page
   enum vm_page_type type;        /* Page type from vm_page_type enum. */
   bool loaded;                   /* If the page is loaded. */
   bool writable;                 /* If the page is writable. */
+  bool cow;                      /* If the page is mapped read-only to a
+                                    frame it shares copy-on-write. */
+  bool large;                    /* If the page is a resident 4 MB page. */
   void *addr;                    /* User virtual address of the page. */
   void *kpage;                   /* Physical address of the page if loaded. */
   uint32_t *pagedir;             /* Page's hardware pagedir. */ 
-  struct list_elem frame_elem;   /* List elem for frame shared pages list. */
+  struct thread *owner;          /* Process the page belongs to. */
+  size_t rmap_idx;               /* Index in its frame's reverse map. */
+  struct list_elem large_elem;   /* List elem for the owner's large
+                                    pages list. */
+  struct lock lock;              /* Serializes loading, unloading and
+                                    cleaning of the page. */
 
   struct        
   {
@@ -30,32 +44,81 @@ struct vm_page
     size_t read_bytes;           /* Rad bytes of the file. */
     size_t zero_bytes;           /* Zero bytes of the file. */
     off_t block_id;              /* Inode block index for shared files. */
+    int advice;                  /* Access hint of its mapping, MADV_*. */
   } file_data;
 
   struct
   {
     size_t index;                 /* Swap block index. */
+    bool clean;                   /* If the slot holds a copy of the loaded 
+                                     page written by the page cleaner. */
   } swap_data;
 };
 
+/* Most pages read ahead on a swap fault. */
+#define SWAP_READAHEAD_MAX 16
+
+/* Most file pages read around a file page fault. */
+#define FAULT_AROUND_MAX 8
+
+/* Stack region reserved below PHYS_BASE. Its lowest page is a guard
+   page that is never mapped, so a stack overflow faults there
+   instead of running into the data below it. */
+#define STACK_MAX (8 * 1024 * 1024)
+#define STACK_LIMIT ((uint8_t *) PHYS_BASE - STACK_MAX + PGSIZE)
+
+/* Most bytes below the stack pointer a stack access may touch. */
+#define STACK_SLACK 32
+
+/* Most pages between a stack fault and the previous bottom of the
+   stack loaded on the fault. */
+#define STACK_PREMAP_MAX 8
+
+/* Most dirty pages of a memory mapped file written back with a
+   single write. */
+#define SYNC_CLUSTER_PAGES 8
+
+/* Number of pages read ahead on a swap fault and around a file
+   page fault. */
+extern size_t vm_swap_readahead;
+extern size_t vm_fault_around;
+
 /* Initialize the page locks. */
 void vm_page_init (void);
 /* Create a new page. */
 struct vm_page *vm_new_file_page (void *, struct file *, off_t, uint32_t, 
                                   uint32_t, bool, off_t);
 struct vm_page *vm_new_zero_page (void *, bool);
+/* Map a large zero page / free a process's large pages. */
+bool vm_new_large_zero_page (void *, bool);
+void vm_free_large_pages (void);
+void vm_page_print_stats (void);
+/* Paging statistics. */
+void vm_page_count_fault (int64_t);
+void vm_page_get_stats (struct thread *, struct vmstat *);
+void vm_page_report (struct thread *);
 /* Load or unload the given page. */
 bool vm_load_page (struct vm_page *, bool);
+bool vm_load_page_for_write (struct vm_page *, bool);
+off_t vm_page_share_id (struct vm_page *);
 void vm_unload_page (struct vm_page *, void *);
-/* Grow a thread's stack. */
-struct vm_page *vm_grow_stack (void *, bool);
+/* Unload a cluster of pages to consecutive swap slots. */
+bool vm_page_needs_swap (struct vm_page *);
+void vm_unload_swap_cluster (struct vm_page **, void **, size_t);
+/* Write a loaded page back to its store without unloading it. */
+bool vm_page_is_clean (struct vm_page *);
+void vm_clean_page (struct vm_page *, void *);
+size_t vm_sync_pages (struct vm_page *, void *, bool);
+/* Read a file page in the background. */
+bool vm_prefetch_page (struct vm_page *);
 /* Pin or unpin a page's underlying frame. */
 void vm_pin_page (struct vm_page *);
 void vm_unpin_page (struct vm_page *);
 /* Find / Free a given page. */
 struct vm_page *vm_find_page (void *);
+struct vm_page *vm_find_user_page (void *, const void *);
 void vm_free_page (struct vm_page *);
-/* Heuristic for stack access. */
-bool stack_access (const void *, void *);
+/* Check for the reserved stack region. */
+bool vm_stack_region (const void *);
 
 #endif /* vm/page.h */
@@ -1,92 +1,290 @@
 #include "vm/swap.h"
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 #include <bitmap.h>
+#include <round.h>
 #include "devices/block.h"
+#include "threads/malloc.h"
 #include "threads/synch.h"
 #include "threads/palloc.h"
 #include "threads/vaddr.h"
-
-#define BLOCKS_PER_PAGE (PGSIZE / BLOCK_SECTOR_SIZE)
+#include "vm/zswap.h"
 
 static struct block *swap_block;
 static struct lock swap_lock;
 
+/* Swap slots, one bit per page of the swap device. The slots are
+   handed out next-fit from a cursor, and the number of free slots
+   of each group of SWAP_GROUP_SLOTS lets the search skip full
+   groups, so an allocation doesn't rescan the full part of the
+   device. */
+#define SWAP_GROUP_SLOTS 32
 static struct bitmap *swap_map;
-static unsigned swap_size;
+static size_t slot_cnt;
+static uint8_t *group_free;
+static size_t group_cnt;
+static size_t swap_next;
+
+/* Buffer for writing a cluster of pages with a single request. */
+static uint8_t *cluster_buf;
+static struct lock cluster_lock;
+
+/* Pages written to and read from the swap device. */
+static unsigned long long disk_store_cnt;
+static unsigned long long disk_load_cnt;
+
+static size_t swap_store_disk (void *);
+static size_t slot_alloc (size_t);
+static void slot_mark (size_t, size_t, bool);
 
 /* Initialise swap table. */
 void
 vm_swap_init ()
 {
+  size_t i;
+
   swap_block = block_get_role (BLOCK_SWAP);
   lock_init (&swap_lock);  
 
-  swap_size = block_size (swap_block); 
-  swap_map = bitmap_create (swap_size);
+  slot_cnt = block_size (swap_block) / BLOCKS_PER_PAGE; 
+  swap_map = bitmap_create (slot_cnt);
+  group_cnt = DIV_ROUND_UP (slot_cnt, SWAP_GROUP_SLOTS);
+  group_free = malloc (group_cnt);
+  ASSERT (swap_map != NULL && group_free != NULL);
+  for (i = 0; i < group_cnt; i++)
+    group_free[i] = i < group_cnt - 1 || slot_cnt % SWAP_GROUP_SLOTS == 0
+                    ? SWAP_GROUP_SLOTS : slot_cnt % SWAP_GROUP_SLOTS;
+
+  lock_init (&cluster_lock);
+  cluster_buf = palloc_get_multiple (PAL_ASSERT, SWAP_CLUSTER_PAGES);
+
+  vm_zswap_init ();
 }
 
-/* Loads a page from the swap to main memory. */
+/* Loads a page from the swap to main memory. A page of the swap
+   device is read with a single request. */
 void
 vm_swap_load (size_t index, void *addr)
 {
-  lock_acquire (&swap_lock);
- 
-  size_t ofs; 
-  for (ofs = 0; ofs < BLOCKS_PER_PAGE; ++ofs)
+  if (vm_zswap_owns (index))
     {
-      /* Make sure the index is valid. */
-      ASSERT (index < swap_size);
-      ASSERT ( bitmap_test (swap_map, index) );
-
-      block_read (swap_block, index, addr + ofs * BLOCK_SECTOR_SIZE);
-      ++index;
+      vm_zswap_load (index, addr);
+      return;
     }
 
+  lock_acquire (&swap_lock);
+  disk_load_cnt++;
+
+  /* Make sure the index is valid. */
+  ASSERT (index % BLOCKS_PER_PAGE == 0);
+  ASSERT (index / BLOCKS_PER_PAGE < slot_cnt);
+  ASSERT (bitmap_test (swap_map, index / BLOCKS_PER_PAGE));
+
   lock_release (&swap_lock); 
-}
 
+  block_read_n (swap_block, index, addr, BLOCKS_PER_PAGE);
+}
 
-/* Stores a page from main memory to swap disk. */
-size_t
-vm_swap_store (void *addr)
+/* Loads CNT pages stored in consecutive swap slots starting at
+   INDEX into the frames KPAGES, reading up to SWAP_CLUSTER_PAGES
+   pages with a single request. If another thread is using the
+   cluster buffer the pages are read one by one straight into their
+   frames instead of waiting for its request to complete. */
+void
+vm_swap_load_cluster (size_t index, void **kpages, size_t cnt)
 {
+  size_t i;
+
+  if (cnt == 1)
+    {
+      vm_swap_load (index, kpages[0]);
+      return;
+    }
+
   lock_acquire (&swap_lock);
-  size_t index = bitmap_scan_and_flip (swap_map, 0, BLOCKS_PER_PAGE, false);
+  disk_load_cnt += cnt;
 
-  /* We must have a page at the given index. */
-  ASSERT (index != BITMAP_ERROR);
+  /* Make sure the indexes are valid. */
+  ASSERT (index % BLOCKS_PER_PAGE == 0);
+  ASSERT (index / BLOCKS_PER_PAGE + cnt <= slot_cnt);
+  ASSERT (bitmap_all (swap_map, index / BLOCKS_PER_PAGE, cnt));
+
+  lock_release (&swap_lock);
 
-  size_t ofs, ind = index;
-  for (ofs = 0; ofs < BLOCKS_PER_PAGE; ++ofs)
+  if (!lock_try_acquire (&cluster_lock))
     {
-      /* Make sure the index is valid. */
-      ASSERT (index < swap_size);
-      ASSERT ( bitmap_test (swap_map, ind) );
+      for (i = 0; i < cnt; i++)
+        block_read_n (swap_block, index + i * BLOCKS_PER_PAGE, kpages[i],
+                      BLOCKS_PER_PAGE);
+      return;
+    }
+  while (cnt > 0)
+    {
+      size_t n = cnt < SWAP_CLUSTER_PAGES ? cnt : SWAP_CLUSTER_PAGES;
 
-      block_write (swap_block, ind, addr + ofs * BLOCK_SECTOR_SIZE);
-      ++ind;
+      block_read_n (swap_block, index, cluster_buf, n * BLOCKS_PER_PAGE);
+      for (i = 0; i < n; i++)
+        memcpy (kpages[i], cluster_buf + i * PGSIZE, PGSIZE);
+      index += n * BLOCKS_PER_PAGE;
+      kpages += n;
+      cnt -= n;
     }
+  lock_release (&cluster_lock);
+}
+
+/* Stores a page from main memory to the compressed swap pool or, 
+   if it doesn't fit there, to swap disk. */
+size_t
+vm_swap_store (void *addr)
+{
+  size_t index;
+
+  if (vm_zswap_store (addr, &index))
+    return index;
+  return swap_store_disk (addr);
+}
+
+/* Stores a page from main memory to swap disk. All the sectors of
+   the slot are written with a single request. */
+static size_t
+swap_store_disk (void *addr)
+{
+  lock_acquire (&swap_lock);
+  size_t index = slot_alloc (1);
+  disk_store_cnt++;
   lock_release (&swap_lock);
 
+  /* We must have a page at the given index. */
+  if (index == BITMAP_ERROR)
+    PANIC ("swap device full");
+
+  block_write_n (swap_block, index, addr, BLOCKS_PER_PAGE);
   return index;
 } 
 
+/* Stores CNT pages from main memory, at most SWAP_CLUSTER_PAGES,
+   and stores the index of each page in INDEXES. The pages that 
+   don't fit in the compressed swap pool go to consecutive swap 
+   slots with a single write request. If there is no run of free 
+   slots long enough they are stored one by one. */
+void
+vm_swap_store_cluster (void **kpages, size_t cnt, size_t *indexes)
+{
+  size_t disk[SWAP_CLUSTER_PAGES];
+  size_t disk_cnt = 0;
+  size_t index, i;
+
+  ASSERT (cnt <= SWAP_CLUSTER_PAGES);
+
+  for (i = 0; i < cnt; i++)
+    if (!vm_zswap_store (kpages[i], &indexes[i]))
+      disk[disk_cnt++] = i;
+  if (disk_cnt == 0)
+    return;
+
+  lock_acquire (&swap_lock);
+  index = slot_alloc (disk_cnt);
+  if (index != BITMAP_ERROR)
+    disk_store_cnt += disk_cnt;
+  lock_release (&swap_lock);
+
+  if (index == BITMAP_ERROR)
+    {
+      for (i = 0; i < disk_cnt; i++)
+        indexes[disk[i]] = swap_store_disk (kpages[disk[i]]);
+      return;
+    }
+
+  lock_acquire (&cluster_lock);
+  for (i = 0; i < disk_cnt; i++)
+    {
+      memcpy (cluster_buf + i * PGSIZE, kpages[disk[i]], PGSIZE);
+      indexes[disk[i]] = index + i * BLOCKS_PER_PAGE;
+    }
+  block_write_n (swap_block, index, cluster_buf, 
+                 disk_cnt * BLOCKS_PER_PAGE);
+  lock_release (&cluster_lock);
+}
+
 /* Frees a swap frame. Sets the corresponding bit to zero. */
 void
 vm_swap_free (size_t index)
 {
+  if (vm_zswap_owns (index))
+    {
+      vm_zswap_free (index);
+      return;
+    }
+
+  /* Make sure the index is valid. */
+  ASSERT (index % BLOCKS_PER_PAGE == 0);
+  ASSERT (index / BLOCKS_PER_PAGE < slot_cnt);
+
   lock_acquire (&swap_lock);
-  
-  size_t ofs;
-  for (ofs = 0; ofs < BLOCKS_PER_PAGE; ++ofs)
+  ASSERT (bitmap_test (swap_map, index / BLOCKS_PER_PAGE));
+  slot_mark (index / BLOCKS_PER_PAGE, 1, false);
+  lock_release (&swap_lock);
+}
+
+/* Allocates CNT consecutive free swap slots, searching next-fit
+   from the slot after the last allocation and skipping the groups
+   with no free slot. Returns the index of the first one, a sector
+   number, or BITMAP_ERROR if there is no such run. The caller must
+   hold swap_lock. */
+static size_t
+slot_alloc (size_t cnt)
+{
+  size_t n;
+
+  if (slot_cnt == 0)
+    return BITMAP_ERROR;
+
+  for (n = 0; n <= group_cnt; n++)
     {
-      /* Make sure the index is valid. */
-      ASSERT (index < swap_size);
-      ASSERT ( bitmap_test (swap_map, index) );
+      size_t group = (swap_next / SWAP_GROUP_SLOTS + n) % group_cnt;
+      size_t slot = n == 0 ? swap_next : group * SWAP_GROUP_SLOTS;
+      size_t end = (group + 1) * SWAP_GROUP_SLOTS;
+
+      if (group_free[group] == 0)
+        continue;
 
-      bitmap_reset (swap_map, index);
-      ++index;
+      /* A run starts in this group but may end in the next one. */
+      for (; slot < end && slot + cnt <= slot_cnt; slot++)
+        if (!bitmap_any (swap_map, slot, cnt))
+          {
+            slot_mark (slot, cnt, true);
+            swap_next = slot + cnt < slot_cnt ? slot + cnt : 0;
+            return slot * BLOCKS_PER_PAGE;
+          }
     }
-  lock_release (&swap_lock);
+
+  return BITMAP_ERROR;
+}
+
+/* Marks the CNT swap slots starting at SLOT used if USED is true,
+   free otherwise, and updates the free counts of their groups. The
+   caller must hold swap_lock. */
+static void
+slot_mark (size_t slot, size_t cnt, bool used)
+{
+  size_t i;
+
+  bitmap_set_multiple (swap_map, slot, cnt, used);
+  for (i = slot; i < slot + cnt; i++)
+    {
+      if (used)
+        group_free[i / SWAP_GROUP_SLOTS]--;
+      else
+        group_free[i / SWAP_GROUP_SLOTS]++;
+    }
+}
+
+/* Prints swap statistics. */
+void
+vm_swap_print_stats (void)
+{
+  printf ("Swap: %llu pages written to disk, %llu pages read from disk\n",
+          disk_store_cnt, disk_load_cnt);
+  vm_zswap_print_stats ();
 }
@@ -3,12 +3,24 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include "devices/block.h"
+#include "threads/vaddr.h"
+
+/* Number of sectors of a swap slot. Slot indexes are sector
+   numbers, so the slot after slot I starts at I + BLOCKS_PER_PAGE. */
+#define BLOCKS_PER_PAGE (PGSIZE / BLOCK_SECTOR_SIZE)
+
+/* Most pages written to consecutive swap slots by one request. */
+#define SWAP_CLUSTER_PAGES 4
 
 /* Initialise swap table bitmap. */
 void vm_swap_init (void);
 /* Swap table operations. */
 void vm_swap_load (size_t, void *);
+void vm_swap_load_cluster (size_t, void **, size_t);
 size_t vm_swap_store (void *);
+void vm_swap_store_cluster (void **, size_t, size_t *);
 void vm_swap_free (size_t);
+void vm_swap_print_stats (void);
 
 #endif /* vm/swap.h */
@@ -0,0 +1,278 @@
+#include "vm/zswap.h"
+#include <debug.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* Compressed swap pool. Swapped out pages are compressed into
+   kernel memory before they are written to the swap device.
+   Pages whose words all have the same value, zero pages in most
+   cases, are kept as that single value. Other pages are encoded
+   as runs of zero words and runs of literal words, which suits
+   the mostly zero pages of user processes, and kept if they
+   shrink to at most ZSWAP_MAX_SIZE bytes. An entry takes a malloc
+   block, and malloc's largest block size is 1 kB, a larger entry
+   would take a whole page and save nothing. Entries are charged
+   to the pool by the size of their block.
+
+   An entry is identified by its kernel address, which is used as
+   its swap index. Indexes of the swap device are sector numbers,
+   which are far below PHYS_BASE, so the two can't be confused. */
+
+/* Words per page. */
+#define PAGE_WORDS (PGSIZE / sizeof (uint32_t))
+
+/* Token bit marking a run of zero words, the low bits hold the
+   length of the run. A token without it is followed by that many
+   literal words. */
+#define TOKEN_ZERO 0x8000
+
+struct zswap_entry
+  {
+    uint32_t fill;              /* Word value of a same-filled page. */
+    size_t size;                /* Bytes of compressed data, 0 if the
+                                   page is same-filled. */
+    uint8_t data[];             /* Compressed data. */
+  };
+
+/* Largest compressed page we keep, so an entry fits in the largest
+   malloc block. */
+#define ZSWAP_MAX_SIZE (PGSIZE / 4 - sizeof (struct zswap_entry))
+
+size_t vm_zswap_pool_pages = 32;
+
+static struct lock zswap_lock;
+static size_t pool_bytes;
+static uint8_t scratch[ZSWAP_MAX_SIZE];
+
+/* Statistics. */
+static unsigned long long same_cnt;      /* Same-filled pages stored. */
+static unsigned long long compress_cnt;  /* Compressed pages stored. */
+static unsigned long long reject_cnt;    /* Pages that didn't compress. */
+static unsigned long long full_cnt;      /* Pages that didn't fit. */
+static unsigned long long load_cnt;      /* Pages loaded from the pool. */
+static unsigned long long bytes_in;      /* Size of compressed pages. */
+static unsigned long long bytes_out;     /* Size of their entries. */
+
+static bool charge_pool (struct zswap_entry *);
+static bool same_filled (const uint32_t *);
+static size_t compress_page (const uint32_t *, uint8_t *, size_t);
+static void decompress_page (const uint8_t *, size_t, uint32_t *);
+
+/* Initialise the compressed swap pool. */
+void
+vm_zswap_init (void)
+{
+  lock_init (&zswap_lock);
+}
+
+/* Tries to keep the page at KPAGE in the pool. On success stores
+   the index of its entry in INDEX and returns true. Returns false
+   if the page doesn't compress well enough, the pool is full or
+   disabled, in which case it has to go to the swap device. */
+bool
+vm_zswap_store (const void *kpage, size_t *index)
+{
+  const uint32_t *words = kpage;
+  struct zswap_entry *e;
+  size_t size;
+
+  if (vm_zswap_pool_pages == 0)
+    return false;
+
+  if (same_filled (words))
+    {
+      e = malloc (sizeof *e);
+      if (e == NULL)
+        return false;
+      e->fill = words[0];
+      e->size = 0;
+
+      lock_acquire (&zswap_lock);
+      if (!charge_pool (e))
+        {
+          full_cnt++;
+          lock_release (&zswap_lock);
+          free (e);
+          return false;
+        }
+      same_cnt++;
+      lock_release (&zswap_lock);
+    }
+  else
+    {
+      lock_acquire (&zswap_lock);
+      size = compress_page (words, scratch, ZSWAP_MAX_SIZE);
+      if (size == 0)
+        {
+          reject_cnt++;
+          lock_release (&zswap_lock);
+          return false;
+        }
+      e = malloc (sizeof *e + size);
+      if (e == NULL || !charge_pool (e))
+        {
+          full_cnt++;
+          lock_release (&zswap_lock);
+          free (e);
+          return false;
+        }
+      e->fill = 0;
+      e->size = size;
+      memcpy (e->data, scratch, size);
+      compress_cnt++;
+      bytes_in += PGSIZE;
+      bytes_out += malloc_size (e);
+      lock_release (&zswap_lock);
+    }
+
+  ASSERT (vm_zswap_owns ((size_t) e));
+  *index = (size_t) e;
+  return true;
+}
+
+/* Returns true if INDEX identifies an entry of the pool rather
+   than a slot of the swap device. */
+bool
+vm_zswap_owns (size_t index)
+{
+  return index >= (size_t) PHYS_BASE;
+}
+
+/* Loads the page of pool entry INDEX into KPAGE. The entry stays
+   in the pool until it is freed. */
+void
+vm_zswap_load (size_t index, void *kpage)
+{
+  struct zswap_entry *e = (struct zswap_entry *) index;
+  uint32_t *words = kpage;
+
+  ASSERT (vm_zswap_owns (index));
+
+  if (e->size == 0)
+    {
+      size_t i;
+      for (i = 0; i < PAGE_WORDS; i++)
+        words[i] = e->fill;
+    }
+  else
+    decompress_page (e->data, e->size, words);
+
+  lock_acquire (&zswap_lock);
+  load_cnt++;
+  lock_release (&zswap_lock);
+}
+
+/* Frees pool entry INDEX. */
+void
+vm_zswap_free (size_t index)
+{
+  struct zswap_entry *e = (struct zswap_entry *) index;
+
+  ASSERT (vm_zswap_owns (index));
+
+  lock_acquire (&zswap_lock);
+  pool_bytes -= malloc_size (e);
+  lock_release (&zswap_lock);
+  free (e);
+}
+
+/* Prints compressed swap statistics. */
+void
+vm_zswap_print_stats (void)
+{
+  printf ("Zswap: %llu same-filled, %llu compressed, %llu incompressible, "
+          "%llu pool full, %llu loads, %llu/%llu bytes\n",
+          same_cnt, compress_cnt, reject_cnt, full_cnt, load_cnt,
+          bytes_out, bytes_in);
+}
+
+/* Adds the block of entry E to the pool and returns true, or 
+   returns false if it doesn't fit. The caller must hold 
+   zswap_lock. */
+static bool
+charge_pool (struct zswap_entry *e)
+{
+  size_t bytes = malloc_size (e);
+
+  if (pool_bytes + bytes > vm_zswap_pool_pages * PGSIZE)
+    return false;
+  pool_bytes += bytes;
+  return true;
+}
+
+/* Returns true if all the words of page WORDS are the same. */
+static bool
+same_filled (const uint32_t *words)
+{
+  size_t i;
+
+  for (i = 1; i < PAGE_WORDS; i++)
+    if (words[i] != words[0])
+      return false;
+  return true;
+}
+
+/* Compresses page WORDS into OUT. Returns the compressed size, or
+   0 if it would take more than MAX bytes. */
+static size_t
+compress_page (const uint32_t *words, uint8_t *out, size_t max)
+{
+  size_t i = 0, size = 0;
+
+  while (i < PAGE_WORDS)
+    {
+      bool zero = words[i] == 0;
+      size_t run = 0;
+      size_t bytes;
+      uint16_t token;
+
+      while (i + run < PAGE_WORDS && (words[i + run] == 0) == zero)
+        run++;
+
+      bytes = sizeof token + (zero ? 0 : run * sizeof *words);
+      if (size + bytes > max)
+        return 0;
+
+      token = zero ? TOKEN_ZERO | run : run;
+      memcpy (out + size, &token, sizeof token);
+      if (!zero)
+        memcpy (out + size + sizeof token, words + i, run * sizeof *words);
+      size += bytes;
+      i += run;
+    }
+
+  return size;
+}
+
+/* Decompresses SIZE bytes at IN into page WORDS. */
+static void
+decompress_page (const uint8_t *in, size_t size, uint32_t *words)
+{
+  size_t i = 0, pos = 0;
+
+  while (pos < size)
+    {
+      uint16_t token;
+      size_t run;
+
+      memcpy (&token, in + pos, sizeof token);
+      pos += sizeof token;
+      run = token & ~TOKEN_ZERO;
+      ASSERT (i + run <= PAGE_WORDS);
+
+      if (token & TOKEN_ZERO)
+        memset (words + i, 0, run * sizeof *words);
+      else
+        {
+          memcpy (words + i, in + pos, run * sizeof *words);
+          pos += run * sizeof *words;
+        }
+      i += run;
+    }
+
+  ASSERT (i == PAGE_WORDS);
+}
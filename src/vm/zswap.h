@@ -0,0 +1,20 @@
+#ifndef VM_ZSWAP_H
+#define VM_ZSWAP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Size of the compressed swap pool in pages. Controlled by the
+   kernel command line. 0 disables the pool. */
+extern size_t vm_zswap_pool_pages;
+
+/* Initialise the compressed swap pool. */
+void vm_zswap_init (void);
+/* Compressed swap operations. */
+bool vm_zswap_store (const void *, size_t *);
+bool vm_zswap_owns (size_t);
+void vm_zswap_load (size_t, void *);
+void vm_zswap_free (size_t);
+void vm_zswap_print_stats (void);
+
+#endif /* vm/zswap.h */